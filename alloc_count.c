@@ -0,0 +1,74 @@
+// dl_iterate_phdr
+#define _GNU_SOURCE
+#include "alloc_count.h"
+
+#include <link.h>
+#include <stdint.h>
+#include <string.h>
+
+// every allocation in the process goes through these, including the ones made by stdio
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// per thread, so helper threads such as the replay server do not show up in the counts
+static __thread size_t allocs;
+
+// code of the ignored object, [begin, end)
+static uintptr_t ignored_begin;
+static uintptr_t ignored_end;
+
+static void count(const void *caller)
+{
+    uintptr_t address = (uintptr_t) caller;
+    if (address >= ignored_begin && address < ignored_end) return;
+    ++allocs;
+}
+
+void *malloc(size_t size)
+{
+    count(__builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+    count(__builtin_return_address(0));
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count(__builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+size_t alloc_count(void)
+{
+    return allocs;
+}
+
+static int find_object(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void) size;
+    if (info->dlpi_name == NULL || strstr(info->dlpi_name, data) == NULL) return 0;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+        if (header->p_type != PT_LOAD || !(header->p_flags & PF_X)) continue;
+        ignored_begin = info->dlpi_addr + header->p_vaddr;
+        ignored_end = ignored_begin + header->p_memsz;
+        return 1;
+    }
+    return 0;
+}
+
+bool alloc_count_ignore(const char *name)
+{
+    return dl_iterate_phdr(find_object, (void *) name) != 0;
+}
@@ -0,0 +1,16 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Heap allocations of the calling thread, counted by interposing malloc, calloc and realloc.
+// Linked into the bench and test executables only, never into the library.
+
+size_t alloc_count(void);
+
+// allocations made by the code of the loaded object whose file name contains name, like
+// "libxcb.so" for the replies xcb reads, are not counted; false when no such object is loaded
+bool alloc_count_ignore(const char *name);
+
+#endif // ALLOC_COUNT_H
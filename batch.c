@@ -0,0 +1,261 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "dpi.h"
+#include "log.h"
+#include "screen_info.h"
+
+// xcb may read replies into its queue while writing, which leaves nothing on the socket to
+// wake up for; every connection is polled again after this long without socket activity
+#define BATCH_SWEEP_MS 50
+
+// how long the whole batch may take without --timeout, so one wedged display cannot stall it
+#define BATCH_TIMEOUT_MS 10000
+
+typedef struct BatchDisplay {
+    const char        *name;
+    ScreenInfoConnect *attempt;
+    xcb_connection_t  *conn;
+    ScreenInfoProbe   *probe;
+} BatchDisplay;
+
+static char *read_display_list(const char *display_list)
+{
+    if (strcmp(display_list, "-") != 0) return strdup(display_list);
+
+    char *list = NULL;
+    size_t len = 0;
+    FILE *stream = open_memstream(&list, &len);
+    if (stream == NULL) return NULL;
+    char chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+        fwrite(chunk, 1, read, stream);
+    }
+    fclose(stream);
+    return list;
+}
+
+static size_t split_display_list(char *list, BatchDisplay **displays)
+{
+    size_t num_displays = 0, cap = 0;
+    *displays = NULL;
+    for (char *save = NULL, *name = strtok_r(list, ", \t\r\n", &save); name != NULL;
+         name = strtok_r(NULL, ", \t\r\n", &save)) {
+        if (num_displays == cap) {
+            cap = cap ? cap * 2 : 64;
+            BatchDisplay *grown = realloc(*displays, cap * sizeof(BatchDisplay));
+            if (grown == NULL) break;
+            *displays = grown;
+        }
+        BatchDisplay *display = &(*displays)[num_displays++];
+        display->name = name;
+        display->attempt = NULL;
+        display->conn = NULL;
+        display->probe = NULL;
+    }
+    return num_displays;
+}
+
+static void finish_display(BatchDisplay *display, const char *config_path, const char *config_dir,
+                           const char *index_path, bool all_outputs)
+{
+    const ScreenInfo *infos;
+    size_t num_infos = screen_info_probe_result(display->probe, &infos);
+    uint16_t dpis[SCREEN_INFO_MAX_OUTPUTS];
+    if (dpi_suggest_all(config_path, config_dir, index_path, infos, num_infos, dpis) == 0) {
+        LOG(ERROR, "display %s: no dpi could be suggested", display->name);
+    }
+    for (size_t i = 0; i < num_infos; ++i) {
+        if (dpis[i] == 0) continue;
+        if (all_outputs) {
+            printf("%s %s %u%s\n", display->name, infos[i].output_name, dpis[i],
+                   infos[i].output == infos[i].stamp.primary_output ? " primary" : "");
+        } else {
+            printf("%s %u\n", display->name, dpis[i]);
+        }
+    }
+    fflush(stdout);
+}
+
+static void close_display(BatchDisplay *display)
+{
+    // an attempt nobody waited for is let go at once, a thread still connecting disconnects itself
+    if (display->attempt != NULL) {
+        screen_info_disconnect(screen_info_connect_wait(display->attempt, 0));
+        display->attempt = NULL;
+    }
+    screen_info_probe_free(display->probe);
+    screen_info_disconnect(display->conn);
+    display->probe = NULL;
+    display->conn = NULL;
+}
+
+// returns false when the display is done, whether it succeeded or not
+static bool advance_display(BatchDisplay *display, const char *config_path, const char *config_dir,
+                            const char *index_path, bool all_outputs, bool *ok)
+{
+    switch (screen_info_probe_poll(display->probe)) {
+    case SCREEN_INFO_PROBE_PENDING:
+        return true;
+    case SCREEN_INFO_PROBE_DONE:
+        finish_display(display, config_path, config_dir, index_path, all_outputs);
+        break;
+    case SCREEN_INFO_PROBE_FAILED:
+        LOG(ERROR, "display %s: probe failed", display->name);
+        *ok = false;
+        break;
+    }
+    close_display(display);
+    return false;
+}
+
+// libXau builds the default authority path in a static buffer that concurrent xcb_connect calls
+// free and reallocate under each other; with XAUTHORITY set it returns that instead
+static void pin_xauthority(void)
+{
+    const char *home = getenv("HOME");
+    if (getenv("XAUTHORITY") != NULL || home == NULL) return;
+    // the same name libXau would come up with, a home of "/" gets no second slash
+    const char *file = home[0] != '\0' && home[1] == '\0' ? ".Xauthority" : "/.Xauthority";
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s%s", home, file);
+    if (len > 0 && (size_t) len < sizeof(path)) setenv("XAUTHORITY", path, 0);
+}
+
+static bool start_display(BatchDisplay *display, bool all_outputs)
+{
+    display->conn = screen_info_connect_wait(display->attempt, 0);
+    display->attempt = NULL;
+    if (xcb_connection_has_error(display->conn)) {
+        LOG(ERROR, "display %s: failed to connect to X server", display->name);
+        xcb_disconnect(display->conn);
+        display->conn = NULL;
+        return false;
+    }
+    display->probe = screen_info_probe_start(display->conn, all_outputs);
+    if (display->probe == NULL) {
+        LOG(ERROR, "display %s: %s", display->name, strerror(errno));
+        close_display(display);
+        return false;
+    }
+    return true;
+}
+
+bool batch_run(const char *display_list, const char *config_path, const char *config_dir, const char *index_path,
+               bool all_outputs, unsigned timeout_ms)
+{
+    uint64_t deadline = screen_info_deadline_after(timeout_ms ? timeout_ms : BATCH_TIMEOUT_MS);
+    char *list = read_display_list(display_list);
+    if (list == NULL) {
+        LOG(ERROR, "failed to read the display list: %s", strerror(errno));
+        return false;
+    }
+    BatchDisplay *displays;
+    size_t num_displays = split_display_list(list, &displays);
+    // the first entry is the eventfd the connecting threads bump, the rest are connections
+    struct pollfd *fds = calloc(num_displays + 1, sizeof(struct pollfd));
+    size_t *active = calloc(num_displays ? num_displays : 1, sizeof(size_t));
+    size_t *connecting = calloc(num_displays ? num_displays : 1, sizeof(size_t));
+    if (fds == NULL || active == NULL || connecting == NULL) {
+        LOG(ERROR, "failed to allocate %zu displays", num_displays);
+        num_displays = 0;
+    } else if (num_displays == 0) {
+        LOG(ERROR, "no displays given");
+    }
+    bool ok = num_displays > 0;
+
+    // the connection setup is synchronous in xcb, every display gets a thread of its own for it
+    // and its probe starts as soon as it is connected; without the eventfd the sweep picks them up
+    pin_xauthority();
+    int notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    size_t num_connecting = 0, num_active = 0;
+    for (size_t i = 0; i < num_displays; ++i) {
+        displays[i].attempt = screen_info_connect_start(displays[i].name, notify_fd);
+        if (displays[i].attempt == NULL) {
+            LOG(ERROR, "display %s: %s", displays[i].name, strerror(errno));
+            ok = false;
+            continue;
+        }
+        connecting[num_connecting++] = i;
+    }
+
+    while (num_connecting + num_active > 0) {
+        size_t still_connecting = 0;
+        for (size_t i = 0; i < num_connecting; ++i) {
+            BatchDisplay *display = &displays[connecting[i]];
+            if (!screen_info_connect_ready(display->attempt)) {
+                connecting[still_connecting++] = connecting[i];
+            } else if (start_display(display, all_outputs)) {
+                active[num_active++] = connecting[i];
+            } else {
+                ok = false;
+            }
+        }
+        num_connecting = still_connecting;
+        if (num_connecting + num_active == 0) break;
+
+        int remaining_ms = screen_info_remaining_ms(deadline);
+        if (remaining_ms == 0) {
+            for (size_t i = 0; i < num_connecting; ++i) {
+                LOG(ERROR, "display %s: timed out connecting to X server", displays[connecting[i]].name);
+            }
+            for (size_t i = 0; i < num_active; ++i) {
+                LOG(ERROR, "display %s: timed out waiting for the X server", displays[active[i]].name);
+            }
+            ok = false;
+            break;
+        }
+
+        fds[0].fd = notify_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (size_t i = 0; i < num_active; ++i) {
+            fds[i + 1].fd = xcb_get_file_descriptor(displays[active[i]].conn);
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+        }
+        int ready = poll(fds, num_active + 1, remaining_ms < BATCH_SWEEP_MS ? remaining_ms : BATCH_SWEEP_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR, "poll failed: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+        if (fds[0].revents != 0) {
+            uint64_t count;
+            if (read(notify_fd, &count, sizeof(count)) < 0) LOG(DEBUG, "eventfd: %s", strerror(errno));
+            --ready;
+        }
+        size_t still_active = 0;
+        for (size_t i = 0; i < num_active; ++i) {
+            BatchDisplay *display = &displays[active[i]];
+            bool pending = (ready > 0 && fds[i + 1].revents == 0)
+                || advance_display(display, config_path, config_dir, index_path, all_outputs, &ok);
+            if (pending) {
+                active[still_active++] = active[i];
+            }
+        }
+        num_active = still_active;
+    }
+
+    for (size_t i = 0; i < num_displays; ++i) {
+        close_display(&displays[i]);
+    }
+    if (notify_fd >= 0) close(notify_fd);
+    free(connecting);
+    free(active);
+    free(fds);
+    free(displays);
+    free(list);
+    return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Probes many X displays at once: every connection is driven from one poll loop, so the
+// wall time is about that of the slowest display rather than the sum of all of them.
+// Results are printed as soon as a display is done, "DISPLAY DPI" for its primary output
+// or "DISPLAY OUTPUT DPI[ primary]" per output with all_outputs. The list separates
+// display names by commas or whitespace, "-" reads it from stdin. Displays still connecting
+// or probing after timeout_ms (0 for a default of 10 s) are given up on as failed.
+bool batch_run(const char *display_list, const char *config_path, const char *config_dir, const char *index_path,
+               bool all_outputs, unsigned timeout_ms);
+
+#endif // BATCH_H
@@ -0,0 +1,387 @@
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc_count.h"
+#include "buffer.h"
+#include "config.h"
+#include "edid.h"
+#include "format.h"
+#include "log.h"
+#include "screen_info.h"
+#include "screen_info_replay.h"
+
+// Microbenchmarks for the hot paths. The human readable table goes to stderr, one JSON
+// object per benchmark goes to stdout (or --output) so runs can be diffed between releases.
+
+#define BENCH_MAX_EDIDS 4096
+#define BENCH_MAX_EDID 32768
+
+typedef struct Bench {
+    const char *name;
+    void      (*run)(void *arg);
+    void       *arg;
+    size_t      ops_per_run; // how many operations one call of run() performs
+} Bench;
+
+typedef struct BenchResult {
+    size_t ops;
+    double ns_per_op;
+    double allocs_per_op;
+} BenchResult;
+
+static double min_time = 0.2;
+static FILE *results;
+static FILE *null_stream;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void run_bench(const Bench *bench)
+{
+    // one warm-up call, then double the number of runs until the batch takes long enough
+    bench->run(bench->arg);
+    size_t runs = 1;
+    BenchResult result;
+    for (;;) {
+        size_t allocs = alloc_count();
+        double start = now_ns();
+        for (size_t i = 0; i < runs; ++i) {
+            bench->run(bench->arg);
+        }
+        double elapsed = now_ns() - start;
+        allocs = alloc_count() - allocs;
+        result.ops = runs * bench->ops_per_run;
+        result.ns_per_op = elapsed / (double) result.ops;
+        result.allocs_per_op = (double) allocs / (double) result.ops;
+        if (elapsed >= min_time * 1e9 || runs >= (SIZE_MAX >> 1u)) break;
+        runs *= 2;
+    }
+
+    fprintf(stderr, "%-32s %12zu ops %12.1f ns/op %10.3f allocs/op\n",
+            bench->name, result.ops, result.ns_per_op, result.allocs_per_op);
+    fputs("{\"name\": ", results);
+    fmt_quote_string(results, bench->name);
+    fprintf(results, ", \"ops\": %zu, \"ns_per_op\": %.3f, \"allocs_per_op\": %.6f}\n",
+            result.ops, result.ns_per_op, result.allocs_per_op);
+    fflush(results);
+}
+
+// read_config_row
+
+typedef struct ConfigBench {
+    char path[PATH_MAX];
+} ConfigBench;
+
+static bool generate_config(ConfigBench *bench, size_t rows)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(bench->path, sizeof(bench->path), "%s/suggestdpi_bench.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemp(bench->path);
+    if (fd < 0) {
+        LOG(ERROR, "failed to create %s: %s", bench->path, strerror(errno));
+        return false;
+    }
+    FILE *out = fdopen(fd, "w");
+    static const char *pnps[] = {"DEL", "GSM", "AUS", "SAM", "BNQ", "ACR", "LEN", "HWP"};
+    fputs("# generated by suggestdpi_bench\n", out);
+    for (size_t i = 0; i < rows; ++i) {
+        switch (i % 4) {
+        case 0:
+            fprintf(out, "pnp=\"%s\" product=0x%04zx dpi=%zu\n", pnps[i % 8], i & 0xffffu, 96 + (i % 5) * 24);
+            break;
+        case 1:
+            fprintf(out, "pnp=\"%s\" name=\"Monitor %zu\" dpi=%zu # comment\n", pnps[i % 8], i, 96 + (i % 5) * 24);
+            break;
+        case 2:
+            fprintf(out, "serial=\"SN%08zu\" dpi=%zu\n", i, 96 + (i % 5) * 24);
+            break;
+        default:
+            fprintf(out, "pnp=\"%s\" product=0x%04zx name=\"Panel \\\"%zu\\\"\" serial=\"%zu\" dpi=%zu\n",
+                    pnps[i % 8], i & 0xffffu, i, i, 96 + (i % 5) * 24);
+            break;
+        }
+    }
+    return fclose(out) == 0;
+}
+
+static void bench_config(void *arg)
+{
+    ConfigBench *bench = arg;
+    ConfigFile file;
+    if (!config_open(&file, bench->path)) abort();
+    ConfigRow row;
+    while (read_config_row(&file, &row)) {
+    }
+    config_close(&file);
+}
+
+// parse_edid
+
+typedef struct EdidCorpus {
+    Buffer  edids[BENCH_MAX_EDIDS];
+    size_t  num_edids;
+} EdidCorpus;
+
+static void put_descriptor(uint8_t *edid, int slot, uint8_t tag, const char *text)
+{
+    uint8_t *desc = edid + 54 + slot * 18;
+    memset(desc, 0, 18);
+    desc[3] = tag;
+    memset(desc + 5, ' ', 13);
+    size_t len = strlen(text);
+    memcpy(desc + 5, text, len < 13 ? len : 13);
+    if (len < 13) desc[5 + len] = '\n';
+}
+
+static void add_synthetic_edids(EdidCorpus *corpus, size_t count)
+{
+    for (size_t i = 0; i < count && corpus->num_edids < BENCH_MAX_EDIDS; ++i) {
+        uint8_t *edid = calloc(1, 128);
+        static const uint8_t header[8] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+        memcpy(edid, header, sizeof(header));
+        edid[8] = 0x10u | (uint8_t) (i & 3u);
+        edid[9] = 0xacu;
+        edid[10] = (uint8_t) i;
+        edid[11] = (uint8_t) (i >> 8u);
+        edid[18] = 1;
+        edid[19] = 4;
+        edid[21] = 60;
+        edid[22] = 34;
+        char text[32];
+        snprintf(text, sizeof(text), "MON %zu", i);
+        put_descriptor(edid, 1, 0xfc, text);
+        if (i % 2 == 0) {
+            snprintf(text, sizeof(text), "SN%zu", i);
+            put_descriptor(edid, 2, 0xff, text);
+        }
+        if (i % 3 == 0) {
+            put_descriptor(edid, 3, 0xfe, "ALPHANUM");
+        }
+        uint8_t sum = 0;
+        for (int j = 0; j < 127; ++j) sum += edid[j];
+        edid[127] = (uint8_t) -sum;
+        corpus->edids[corpus->num_edids].ptr = edid;
+        corpus->edids[corpus->num_edids].len = 128;
+        ++corpus->num_edids;
+    }
+}
+
+static void add_edid_file(EdidCorpus *corpus, const char *path)
+{
+    if (corpus->num_edids == BENCH_MAX_EDIDS) return;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return;
+    uint8_t *edid = malloc(BENCH_MAX_EDID);
+    size_t len = fread(edid, 1, BENCH_MAX_EDID, file);
+    fclose(file);
+    if (len < 128) {
+        free(edid);
+        return;
+    }
+    corpus->edids[corpus->num_edids].ptr = edid;
+    corpus->edids[corpus->num_edids].len = len;
+    ++corpus->num_edids;
+}
+
+static void add_edid_path(EdidCorpus *corpus, const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        add_edid_file(corpus, path);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) < (int) sizeof(child)) {
+            add_edid_path(corpus, child);
+        }
+    }
+    closedir(dir);
+}
+
+static void bench_parse_edid(void *arg)
+{
+    EdidCorpus *corpus = arg;
+    EdidInfo info;
+    for (size_t i = 0; i < corpus->num_edids; ++i) {
+        parse_edid(corpus->edids[i], &info);
+    }
+}
+
+static void bench_validate_edid(void *arg)
+{
+    EdidCorpus *corpus = arg;
+    for (size_t i = 0; i < corpus->num_edids; ++i) {
+        validate_edid(corpus->edids[i]);
+    }
+}
+
+// fmt_quote_string and buffer_hexdump
+
+static const char *quote_strings[] = {
+    "DEL",
+    "DELL U2720Q",
+    "with \"quotes\" and \\ backslashes",
+    "control\tcharacters\r\n\x01\x7f",
+    "a plain string that is long enough to cross a few vector widths without escapes",
+};
+
+static void bench_quote_string(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < sizeof(quote_strings) / sizeof(quote_strings[0]); ++i) {
+        fmt_quote_string(null_stream, quote_strings[i]);
+    }
+}
+
+static void bench_hexdump(void *arg)
+{
+    buffer_hexdump(null_stream, arg);
+}
+
+// screen_info_primary against recordings made with suggestdpi --record and no other probe options
+
+#define BENCH_MAX_REPLAYS 64
+
+static void bench_replay_probe(void *arg)
+{
+    (void) arg;
+    struct xcb_connection_t *conn = screen_info_connect();
+    ScreenStamp stamp;
+    ScreenInfo info;
+    if (conn == NULL || !screen_info_stamp(conn, &stamp) || !screen_info_primary(conn, &stamp, &info)) abort();
+    screen_info_disconnect(conn);
+}
+
+struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"output", required_argument, NULL, 'o'},
+    {"min-time", required_argument, NULL, 't'},
+    {"max-rows", required_argument, NULL, 'r'},
+    {"replay", required_argument, NULL, 'p'},
+    {"latency", required_argument, NULL, 'l'},
+    {0, 0, 0, 0},
+};
+
+static void print_usage(const char *exe)
+{
+    static const char *usage =
+        "usage: %s [-h] [-o OUTPUT] [-t SECONDS] [-r ROWS] [-p RECORDING]... [-l US] [EDID...]\n"
+        "\n"
+        "options:\n"
+        "    -h, --help\n"
+        "           show this help\n"
+        "    -o, --output=OUTPUT\n"
+        "           write the results as JSON lines to OUTPUT instead of stdout\n"
+        "    -t, --min-time=SECONDS\n"
+        "           run every benchmark for at least SECONDS (default: 0.2)\n"
+        "    -r, --max-rows=ROWS\n"
+        "           largest generated config, in rows (default: 1000000)\n"
+        "    -p, --replay=RECORDING\n"
+        "           also time the primary output probe against RECORDING, made with suggestdpi --record\n"
+        "    -l, --latency=US\n"
+        "           delay every replayed round trip by US microseconds (default: 0)\n"
+        "\n"
+        "EDID files or directories are added to the synthetic parse_edid corpus.\n";
+    fprintf(stderr, usage, exe);
+}
+
+int main(int argc, char *argv[])
+{
+    int option_idx = 0, option_chr;
+    const char *output_path = NULL;
+    size_t max_rows = 1000000;
+    const char *replays[BENCH_MAX_REPLAYS];
+    size_t num_replays = 0;
+    unsigned latency_us = 0;
+    while ((option_chr = getopt_long(argc, argv, "ho:t:r:p:l:", long_options, &option_idx)) != -1) {
+        switch (option_chr) {
+        case 'h':
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 't':
+            min_time = strtod(optarg, NULL);
+            break;
+        case 'r':
+            max_rows = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            if (num_replays < BENCH_MAX_REPLAYS) replays[num_replays++] = optarg;
+            break;
+        case 'l':
+            latency_us = (unsigned) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_set_level(LOG_LEVEL_ERROR);
+    results = output_path ? fopen(output_path, "w") : stdout;
+    null_stream = fopen("/dev/null", "w");
+    if (results == NULL || null_stream == NULL) {
+        LOG(ERROR, "failed to open output: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    static EdidCorpus corpus;
+    for (int i = optind; i < argc; ++i) {
+        add_edid_path(&corpus, argv[i]);
+    }
+    size_t num_real = corpus.num_edids;
+    add_synthetic_edids(&corpus, 256);
+    fprintf(stderr, "edid corpus: %zu real, %zu synthetic\n", num_real, corpus.num_edids - num_real);
+
+    for (size_t rows = 10; rows <= max_rows; rows *= 10) {
+        static ConfigBench config_bench;
+        if (!generate_config(&config_bench, rows)) return EXIT_FAILURE;
+        char name[64];
+        snprintf(name, sizeof(name), "read_config_row/%zu", rows);
+        Bench bench = {name, bench_config, &config_bench, rows};
+        run_bench(&bench);
+        unlink(config_bench.path);
+    }
+
+    Bench benches[] = {
+        {"parse_edid", bench_parse_edid, &corpus, corpus.num_edids},
+        {"validate_edid", bench_validate_edid, &corpus, corpus.num_edids},
+        {"fmt_quote_string", bench_quote_string, NULL, sizeof(quote_strings) / sizeof(quote_strings[0])},
+        {"buffer_hexdump/128", bench_hexdump, &corpus.edids[num_real], 1},
+    };
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        run_bench(&benches[i]);
+    }
+
+    for (size_t i = 0; i < num_replays; ++i) {
+        if (!screen_info_replay_start(replays[i], latency_us)) return EXIT_FAILURE;
+        const char *base = strrchr(replays[i], '/');
+        char name[64];
+        snprintf(name, sizeof(name), "probe_replay/%s", base ? base + 1 : replays[i]);
+        Bench bench = {name, bench_replay_probe, NULL, 1};
+        run_bench(&bench);
+        screen_info_replay_stop();
+    }
+
+    fclose(null_stream);
+    if (results != stdout) fclose(results);
+    return EXIT_SUCCESS;
+}
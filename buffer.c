@@ -1,8 +1,6 @@
 #include "buffer.h"
 
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 
 void buffer_hexdump(FILE *restrict stream, const Buffer *restrict buffer)
 {
@@ -21,11 +19,3 @@ void buffer_hexdump(FILE *restrict stream, const Buffer *restrict buffer)
     fputc(']', stream);
 }
 
-void buffer_free(Buffer *restrict buffer)
-{
-    if (buffer == NULL) return;
-    if (buffer->ptr == NULL) return;
-    free(buffer->ptr);
-    buffer->ptr = NULL;
-    buffer->len = 0;
-}
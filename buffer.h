@@ -5,12 +5,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+// a borrowed view, the bytes are owned by whoever handed it out (usually an xcb reply)
 typedef struct Buffer {
-    uint8_t *ptr;
-    size_t   len;
+    const uint8_t *ptr;
+    size_t         len;
 } Buffer;
 
 void buffer_hexdump(FILE *restrict stream, const Buffer *restrict buffer);
-void buffer_free(Buffer *restrict buffer);
 
 #endif // BUFFER_H
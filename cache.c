@@ -0,0 +1,167 @@
+#include "cache.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config_set.h"
+#include "log.h"
+
+static const char CACHE_MAGIC[8] = {'S', 'D', 'P', 'I', 'C', 'A', 'C', '\0'};
+static const uint32_t CACHE_VERSION = 4;
+
+typedef struct CacheRecord {
+    char       magic[8];
+    uint32_t   version;
+    uint16_t   dpi;
+    char       display[64];
+    uint64_t   config_dev;
+    uint64_t   config_ino;
+    int64_t    config_size;
+    int64_t    config_mtime_sec;
+    int64_t    config_mtime_nsec;
+    uint64_t   config_set_stamp; // covers the drop-in directory, 0 without one
+    ScreenInfo info;
+} CacheRecord;
+
+static bool cache_path(char *restrict buf, size_t cap, const char *restrict display)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || *runtime_dir == '\0') return false;
+
+    int len = snprintf(buf, cap, "%s/suggestdpi-", runtime_dir);
+    if (len <= 0 || (size_t) len >= cap) return false;
+    // display names may contain slashes (e.g. launchd sockets), keep the file name flat
+    for (const char *ch = display; *ch != '\0'; ++ch) {
+        if ((size_t) len + 1 >= cap) return false;
+        buf[len++] = (isalnum((unsigned char) *ch) || *ch == '.' || *ch == '-') ? *ch : '_';
+    }
+    if ((size_t) len + sizeof(".cache") > cap) return false;
+    memcpy(buf + len, ".cache", sizeof(".cache"));
+    return true;
+}
+
+static void fill_key(CacheRecord *restrict record, const char *restrict display, const char *restrict config_path,
+                     const char *restrict config_dir)
+{
+    memset(record, 0, sizeof(CacheRecord));
+    memcpy(record->magic, CACHE_MAGIC, sizeof(record->magic));
+    record->version = CACHE_VERSION;
+    strncpy(record->display, display, sizeof(record->display) - 1);
+
+    struct stat st;
+    if (stat(config_path, &st) == 0) {
+        record->config_dev = st.st_dev;
+        record->config_ino = st.st_ino;
+        record->config_size = st.st_size;
+        record->config_mtime_sec = st.st_mtim.tv_sec;
+        record->config_mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    if (config_dir != NULL) {
+        record->config_set_stamp = config_set_stamp(config_path, config_dir);
+    }
+}
+
+// reads the record of display when it was computed from the current config
+static bool read_record(const char *restrict display, const char *restrict config_path,
+                        const char *restrict config_dir, CacheRecord *restrict record)
+{
+    char path[PATH_MAX];
+    if (display == NULL || !cache_path(path, sizeof(path), display)) return false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t len = read(fd, record, sizeof(CacheRecord));
+    close(fd);
+    if (len != (ssize_t) sizeof(CacheRecord)) {
+        LOG(DEBUG, "cache: truncated record");
+        return false;
+    }
+
+    CacheRecord expected;
+    fill_key(&expected, display, config_path, config_dir);
+    bool match = memcmp(record->magic, expected.magic, sizeof(record->magic)) == 0
+        && record->version == expected.version
+        && memcmp(record->display, expected.display, sizeof(record->display)) == 0
+        && record->config_dev == expected.config_dev
+        && record->config_ino == expected.config_ino
+        && record->config_size == expected.config_size
+        && record->config_mtime_sec == expected.config_mtime_sec
+        && record->config_mtime_nsec == expected.config_mtime_nsec
+        && record->config_set_stamp == expected.config_set_stamp;
+    if (!match) {
+        LOG(DEBUG, "cache: record for another config");
+    }
+    return match;
+}
+
+bool cache_load(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                ScreenInfo *restrict info, uint16_t *restrict dpi)
+{
+    CacheRecord record;
+    if (!read_record(display, config_path, config_dir, &record)) return false;
+    *info = record.info;
+    *dpi = record.dpi;
+    return true;
+}
+
+bool cache_valid(const ScreenInfo *restrict cached, const ScreenStamp *restrict stamp, uint64_t edid_hash)
+{
+    bool hit = cached->stamp.timestamp == stamp->timestamp
+        && cached->stamp.config_timestamp == stamp->config_timestamp
+        && cached->stamp.primary_output == stamp->primary_output;
+    if (!hit) {
+        LOG(DEBUG, "cache: stale record");
+        return false;
+    }
+    // the timestamps alone miss a monitor swapped while the server was down, or a server
+    // that does not bump them for property changes
+    if (edid_hash == 0 || edid_hash != cached->edid_hash) {
+        LOG(DEBUG, "cache: the edid changed");
+        return false;
+    }
+    LOG(DEBUG, "cache: hit, edid hash 0x%016llx", (unsigned long long) edid_hash);
+    return true;
+}
+
+bool cache_load_stale(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                      uint16_t *restrict dpi)
+{
+    CacheRecord record;
+    if (!read_record(display, config_path, config_dir, &record)) return false;
+    LOG(DEBUG, "cache: last known dpi=%u", record.dpi);
+    *dpi = record.dpi;
+    return true;
+}
+
+void cache_store(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                 const ScreenInfo *restrict info, uint16_t dpi)
+{
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    if (display == NULL || !cache_path(path, sizeof(path), display)) return;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int) sizeof(tmp_path)) return;
+
+    CacheRecord record;
+    fill_key(&record, display, config_path, config_dir);
+    record.info = *info;
+    record.dpi = dpi;
+
+    // unique per call, threads of the library may store the same display at once
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOG(DEBUG, "cache: failed to create record: %s", strerror(errno));
+        return;
+    }
+    bool ok = write(fd, &record, sizeof(record)) == (ssize_t) sizeof(record);
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        LOG(DEBUG, "cache: failed to write record: %s", strerror(errno));
+        unlink(tmp_path);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "screen_info.h"
+
+// Result cache in $XDG_RUNTIME_DIR. An entry is valid for one X display while
+// the RandR stamp of the screen, the EDID of the output and the config file it
+// was computed from stay the same. The EDID is read again along with the stamp
+// (screen_info_stamp_check), so a hit costs a single RandR round trip instead of
+// the full probe. With a drop-in directory every file in it is part of the key
+// as well.
+
+// the record of display computed from the current config, not yet checked against the screen
+bool cache_load(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                ScreenInfo *restrict info, uint16_t *restrict dpi);
+bool cache_valid(const ScreenInfo *restrict cached, const ScreenStamp *restrict stamp, uint64_t edid_hash);
+// the last dpi stored for display and the current config, however the screen changed since
+bool cache_load_stale(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                      uint16_t *restrict dpi);
+void cache_store(const char *restrict display, const char *restrict config_path, const char *restrict config_dir,
+                 const ScreenInfo *restrict info, uint16_t dpi);
+
+#endif // CACHE_H
@@ -1,8 +1,14 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "format.h"
 #include "log.h"
@@ -13,9 +19,14 @@ const uint8_t xdigit_table[256] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 10, 11, 12, 13, 14, 15,
 };
 
-static char *lstrip(char *str)
+static int peek(const char *str, const char *end, size_t i)
 {
-    while (*str != '\0' && isspace(*str)) ++str;
+    return str + i < end ? (unsigned char) str[i] : '\0';
+}
+
+static const char *lstrip(const char *str, const char *end)
+{
+    while (str < end && isspace((unsigned char) *str)) ++str;
     return str;
 }
 
@@ -24,14 +35,45 @@ static bool isodigit(int c)
     return '0' <= c && c < '8';
 }
 
-static char *read_key(char *str)
+static const char *read_key(const char *str, const char *end)
 {
-    while (*str != '\0' && (isalnum(*str) || *str == '_' || *str == '-')) ++str;
+    while (str < end && (isalnum((unsigned char) *str) || *str == '_' || *str == '-')) ++str;
     return str;
 }
 
+typedef enum ConfigKey {
+    CONFIG_KEY_UNKNOWN,
+    CONFIG_KEY_PNP,
+    CONFIG_KEY_PRODUCT,
+    CONFIG_KEY_NAME,
+    CONFIG_KEY_SERIAL,
+    CONFIG_KEY_DPI,
+} ConfigKey;
+
+// perfect hash over the known keys: the low three bits of their second char are all distinct
+static const struct {
+    const char *name;
+    size_t      len;
+    ConfigKey   key;
+} config_key_table[8] = {
+    [('p' & 7)] = {"dpi", 3, CONFIG_KEY_DPI},
+    [('a' & 7)] = {"name", 4, CONFIG_KEY_NAME},
+    [('r' & 7)] = {"product", 7, CONFIG_KEY_PRODUCT},
+    [('e' & 7)] = {"serial", 6, CONFIG_KEY_SERIAL},
+    [('n' & 7)] = {"pnp", 3, CONFIG_KEY_PNP},
+};
+
+static ConfigKey lookup_key(const char *key, size_t len)
+{
+    if (len < 2) return CONFIG_KEY_UNKNOWN;
+    unsigned slot = (unsigned char) key[1] & 7u;
+    if (config_key_table[slot].len != len) return CONFIG_KEY_UNKNOWN;
+    if (memcmp(config_key_table[slot].name, key, len) != 0) return CONFIG_KEY_UNKNOWN;
+    return config_key_table[slot].key;
+}
+
 typedef struct ReadStat {
-    char *next;
+    const char *next;
     bool ok;
     bool overflow;
 } ReadStat;
@@ -40,24 +82,24 @@ typedef struct ReadStat {
 #define STAT_FAIL(x) do { stat.next = str + (x); stat.ok = false; stat.overflow = false; return stat; } while (0)
 #define STAT_OVERFLOW(x) do { stat.next = str + (x); stat.ok = true; stat.overflow = true; return stat; } while (0)
 
-static ReadStat read_string(char *restrict str, char *restrict buf, size_t cap)
+static ReadStat read_string(const char *str, const char *end, char *restrict buf, size_t cap)
 {
     ReadStat stat = {str, true, false};
-    memset(buf, 0, cap);
     char *ptr = buf;
-    if (*str != '"') {
+    if (str == end || *str != '"') {
         STAT_FAIL(0);
     }
     for (++str ;; ++str) {
+        if (str == end) {
+            STAT_FAIL(0);
+        }
         if (*str == '"') {
+            *ptr = '\0';
             STAT_OK(1);
         }
-        if (*str == '\0') {
-            STAT_FAIL(0);
-        }
         if (*str == '\\') {
             ++str;
-            switch (*str) {
+            switch (peek(str, end, 0)) {
             case 'a': *ptr++ = '\a'; break;
             case 'b': *ptr++ = '\b'; break;
             case 'e': *ptr++ = '\033'; break;
@@ -71,27 +113,27 @@ static ReadStat read_string(char *restrict str, char *restrict buf, size_t cap)
             case '\'': *ptr++ = '\''; break;
             case '\"': *ptr++ = '\"'; break;
             case 'x':
-                if (!isxdigit(str[1])) {
+                if (!isxdigit(peek(str, end, 1))) {
                     STAT_FAIL(1);
                 }
-                if (!isxdigit(str[2])) {
+                if (!isxdigit(peek(str, end, 2))) {
                     STAT_FAIL(2);
                 }
                 *ptr++ = (char) ((xdigit_table[(uint8_t) str[1]] << 4u) + xdigit_table[(uint8_t) str[2]]);
                 str += 2;
                 break;
             default:
-                if (!('0' <= *str && *str < '4')) {
+                if (!('0' <= peek(str, end, 0) && peek(str, end, 0) < '4')) {
                     STAT_FAIL(0);
                 }
-                if (str[0] == '0' && !isodigit(str[1])) {
+                if (str[0] == '0' && !isodigit(peek(str, end, 1))) {
                     *ptr++ = '\0';
                     break;
                 }
-                if (!isodigit(str[1])) {
+                if (!isodigit(peek(str, end, 1))) {
                     STAT_FAIL(1);
                 }
-                if (!isodigit(str[2])) {
+                if (!isodigit(peek(str, end, 2))) {
                     STAT_FAIL(2);
                 }
                 *ptr++ = (char) ((xdigit_table[(uint8_t) str[0]] << 6u) + (xdigit_table[(uint8_t) str[1]] << 3u) + xdigit_table[(uint8_t) str[2]]);
@@ -108,18 +150,18 @@ static ReadStat read_string(char *restrict str, char *restrict buf, size_t cap)
     }
 }
 
-static ReadStat read_unsigned(char *str, uint16_t *ptr)
+static ReadStat read_unsigned(const char *str, const char *end, uint16_t *ptr)
 {
     uint64_t val = 0;
     ReadStat stat = {str, true, false};
-    if (!isdigit(*str)) {
+    if (!isdigit(peek(str, end, 0))) {
         STAT_FAIL(0);
     }
 
-    bool is_hex = str[0] == '0' && (str[1] == 'x' || str[1] == 'X');
-    bool is_bin = str[0] == '0' && (str[1] == 'b' || str[1] == 'B');
-    bool is_oct_o = str[0] == '0' && (str[1] == 'o' || str[1] == 'O');
-    bool is_oct_c = str[0] == '0' && isdigit(str[1]);
+    bool is_hex = str[0] == '0' && (peek(str, end, 1) == 'x' || peek(str, end, 1) == 'X');
+    bool is_bin = str[0] == '0' && (peek(str, end, 1) == 'b' || peek(str, end, 1) == 'B');
+    bool is_oct_o = str[0] == '0' && (peek(str, end, 1) == 'o' || peek(str, end, 1) == 'O');
+    bool is_oct_c = str[0] == '0' && isdigit(peek(str, end, 1));
 
     if (is_hex || is_oct_o || is_bin) {
         str += 2;
@@ -127,24 +169,24 @@ static ReadStat read_unsigned(char *str, uint16_t *ptr)
         str += 1;
     }
 
-    if (!isxdigit(*str)) {
+    if (!isxdigit(peek(str, end, 0))) {
         STAT_FAIL(0);
     }
 
     bool is_oct = is_oct_o || is_oct_c;
 
-    for (; *str != '\0'; ++str) {
-        if (isspace(*str)) {
+    for (; str < end; ++str) {
+        if (isspace((unsigned char) *str)) {
             *ptr = (uint16_t) val;
             STAT_OK(0);
         }
-        if (is_hex && isxdigit(*str)) {
+        if (is_hex && isxdigit((unsigned char) *str)) {
             val = val * 16 + xdigit_table[(uint8_t) *str];
         } else if (is_oct && isodigit(*str)) {
             val = val * 8 + xdigit_table[(uint8_t) *str];
         } else if (is_bin && (*str == '0' || *str == '1')) {
             val = val * 2 + xdigit_table[(uint8_t) *str];
-        } else if (isdigit(*str)) {
+        } else if (isdigit((unsigned char) *str)) {
             val = val * 10 + xdigit_table[(uint8_t) *str];
         } else {
             STAT_FAIL(0);
@@ -158,30 +200,107 @@ static ReadStat read_unsigned(char *str, uint16_t *ptr)
     STAT_OK(0);
 }
 
-bool read_config_row(FILE *restrict stream, ConfigRow *restrict config_row)
+bool config_open(ConfigFile *restrict file, const char *restrict path)
 {
-    int *pline = &config_row->line;
-    char buf[1024];
-    char *line = buf;
-    memset(buf, 0, sizeof(buf));
-    while (fgets(buf, sizeof(buf), stream) != NULL) {
-        ++*pline;
-        line = lstrip(buf);
-        if (*line != '\0') {
-            break;
-        }
+    memset(file, 0, sizeof(ConfigFile));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
     }
-    if (feof(stream)) return false;
-    if (ferror(stream)) {
-        LOG(ERROR, "config: line %d: read error", *pline);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
         return false;
     }
 
-    size_t length = strlen(line);
-    if (line[length - 1] != '\n') {
-        LOG(ERROR, "config: line %d: line is too long", *pline);
-        return false;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            file->data = map;
+            file->size = st.st_size;
+            file->next = file->data;
+            file->mapped = true;
+            return true;
+        }
+    }
+
+    // pipes, character devices and the like cannot be mapped, slurp them instead
+    char *data = NULL;
+    size_t size = 0, cap = 0;
+    for (;;) {
+        if (size == cap) {
+            cap = cap ? cap * 2 : 4096;
+            char *new_data = realloc(data, cap);
+            if (new_data == NULL) {
+                free(data);
+                close(fd);
+                errno = ENOMEM;
+                return false;
+            }
+            data = new_data;
+        }
+        ssize_t len = read(fd, data + size, cap - size);
+        if (len < 0 && errno == EINTR) continue;
+        if (len < 0) {
+            int saved_errno = errno;
+            free(data);
+            close(fd);
+            errno = saved_errno;
+            return false;
+        }
+        if (len == 0) break;
+        size += len;
+    }
+    close(fd);
+    file->data = data;
+    file->size = size;
+    file->next = file->data;
+    file->mapped = false;
+    return true;
+}
+
+void config_close(ConfigFile *restrict file)
+{
+    if (file == NULL) return;
+    if (file->data == NULL) return;
+    if (file->mapped) {
+        munmap((void *) file->data, file->size);
+    } else {
+        free((void *) file->data);
     }
+    memset(file, 0, sizeof(ConfigFile));
+}
+
+bool read_config_row(ConfigFile *restrict file, ConfigRow *restrict config_row)
+{
+    const char *data_end = file->data + file->size;
+    const char *buf = NULL, *line = NULL, *end = NULL;
+    while (file->next != NULL && file->next < data_end) {
+        buf = file->next;
+        // glibc memchr is vectorized, which makes it the fastest newline scan we can get here
+        end = memchr(buf, '\n', data_end - buf);
+        if (end == NULL) {
+            end = data_end;
+            file->next = NULL;
+        } else {
+            file->next = end + 1;
+        }
+        ++file->line;
+        line = lstrip(buf, end);
+        if (line != end) {
+            break;
+        }
+        line = NULL;
+    }
+    if (line == NULL) return false;
+    // cleared once the whole line parsed, so every error return below leaves it set
+    file->failed = true;
+
+    int *pline = &config_row->line;
+    *pline = file->line;
 
     config_row->has_pnp = false;
     config_row->has_product = false;
@@ -190,10 +309,10 @@ bool read_config_row(FILE *restrict stream, ConfigRow *restrict config_row)
     config_row->has_dpi = false;
 
     for (;;) {
-        char *key = lstrip(line);
-        char *key_end = read_key(key);
+        const char *key = lstrip(line, end);
+        const char *key_end = read_key(key, end);
         if (key == key_end) {
-            if (*key_end == '\0' || *key_end == '#') {
+            if (key_end == end || *key_end == '#') {
                 // end of line or comment
                 break;
             } else {
@@ -201,47 +320,57 @@ bool read_config_row(FILE *restrict stream, ConfigRow *restrict config_row)
                 return false;
             }
         }
-        char *equ_begin = lstrip(key_end);
-        if (*equ_begin != '=') {
-            LOG(ERROR, "config: line %d: expected '=', got '%s'", *pline, fmt_escape_char(*key));
+        const char *equ_begin = lstrip(key_end, end);
+        if (equ_begin == end || *equ_begin != '=') {
+            LOG(ERROR, "config: line %d: expected '=', got '%s'", *pline, fmt_escape_char((char) peek(equ_begin, end, 0)));
             return false;
         }
-        *key_end = '\0';
 
-        char *value_begin = lstrip(equ_begin + 1);
+        const char *value_begin = lstrip(equ_begin + 1, end);
         ReadStat read_stat;
 
-        if (strcmp(key, "pnp") == 0) {
-            read_stat = read_string(value_begin, config_row->pnp, sizeof(config_row->pnp));
+        switch (lookup_key(key, key_end - key)) {
+        case CONFIG_KEY_PNP:
+            read_stat = read_string(value_begin, end, config_row->pnp, sizeof(config_row->pnp));
             config_row->has_pnp = read_stat.ok;
-        } else if (strcmp(key, "product") == 0) {
-            read_stat = read_unsigned(value_begin, &config_row->product);
+            break;
+        case CONFIG_KEY_PRODUCT:
+            read_stat = read_unsigned(value_begin, end, &config_row->product);
             config_row->has_product = read_stat.ok;
-        } else if (strcmp(key, "name") == 0) {
-            read_stat = read_string(value_begin, config_row->name, sizeof(config_row->name));
+            break;
+        case CONFIG_KEY_NAME:
+            read_stat = read_string(value_begin, end, config_row->name, sizeof(config_row->name));
             config_row->has_name = read_stat.ok;
-        } else if (strcmp(key, "serial") == 0) {
-            read_stat = read_string(value_begin, config_row->serial, sizeof(config_row->serial));
+            break;
+        case CONFIG_KEY_SERIAL:
+            read_stat = read_string(value_begin, end, config_row->serial, sizeof(config_row->serial));
             config_row->has_serial = read_stat.ok;
-        } else if (strcmp(key, "dpi") == 0) {
-            read_stat = read_unsigned(value_begin, &config_row->dpi);
+            break;
+        case CONFIG_KEY_DPI:
+            read_stat = read_unsigned(value_begin, end, &config_row->dpi);
             config_row->has_dpi = read_stat.ok;
-        } else {
+            break;
+        default: {
+            char key_name[64];
+            size_t key_len = (size_t) (key_end - key) < sizeof(key_name) ? (size_t) (key_end - key) : sizeof(key_name) - 1;
+            memcpy(key_name, key, key_len);
+            key_name[key_len] = '\0';
             LOGB(ERROR, out) {
                 fprintf(out, "config: line %d: unknown key ", *pline);
-                fmt_quote_string(out, key);
+                fmt_quote_string(out, key_name);
             }
             return false;
         }
+        }
 
         if (!read_stat.ok) {
-            LOG(ERROR, "config: line %d col %ld: unexpected char '%s'", *pline, read_stat.next - buf + 1, fmt_escape_char(*read_stat.next));
+            LOG(ERROR, "config: line %d col %ld: unexpected char '%s'", *pline, read_stat.next - buf + 1, fmt_escape_char((char) peek(read_stat.next, end, 0)));
             return false;
         }
         if (read_stat.overflow) {
             LOGB(ERROR, out) {
                 fprintf(out, "config: line %d col %ld: value of ", *pline, read_stat.next - buf + 1);
-                fmt_quote_string(out, key);
+                fprintf(out, "\"%.*s\"", (int) (key_end - key), key);
                 fputs(" is too long", out);
             }
             return false;
@@ -273,5 +402,114 @@ bool read_config_row(FILE *restrict stream, ConfigRow *restrict config_row)
         fputs(" # eol", out);
     }
 
+    file->failed = false;
+    return true;
+}
+
+bool config_row_match(const ConfigRow *restrict config_row, const EdidInfo *restrict edid)
+{
+    if (config_row->has_pnp && strcmp(config_row->pnp, edid->pnp_id) != 0) return false;
+    if (config_row->has_product && config_row->product != edid->product_id) return false;
+    if (config_row->has_name && !edid_string_equals(&edid->product_name, config_row->name)) return false;
+    if (config_row->has_serial && !edid_string_equals(&edid->serial_number, config_row->serial)) return false;
+    return true;
+}
+
+static void match_value(char value[16], const char *str, size_t cap)
+{
+    memset(value, 0, 16);
+    memcpy(value, str, strnlen(str, cap - 1));
+}
+
+static const ConfigMatchSlot *match_slot(const ConfigMatchSlot *slots, const char value[16])
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 16; ++i) {
+        hash ^= (uint8_t) value[i];
+        hash *= 16777619u;
+    }
+    // at most CONFIG_MATCH_MAX_OUTPUTS values live in twice as many slots, so there is always a free one
+    size_t slot = hash & (CONFIG_MATCH_SLOTS - 1);
+    while (slots[slot].used && memcmp(slots[slot].value, value, 16) != 0) {
+        slot = (slot + 1) & (CONFIG_MATCH_SLOTS - 1);
+    }
+    return &slots[slot];
+}
+
+static void match_insert(ConfigMatchSlot *slots, const char value[16], ConfigOutputMask bit)
+{
+    ConfigMatchSlot *slot = (ConfigMatchSlot *) match_slot(slots, value);
+    if (!slot->used) {
+        memcpy(slot->value, value, 16);
+        slot->used = true;
+    }
+    slot->mask |= bit;
+}
+
+static ConfigOutputMask match_lookup(const ConfigMatchSlot *slots, const char value[16])
+{
+    const ConfigMatchSlot *slot = match_slot(slots, value);
+    return slot->used ? slot->mask : 0;
+}
+
+void config_matcher_init(ConfigMatcher *restrict matcher)
+{
+    memset(matcher, 0, sizeof(ConfigMatcher));
+}
+
+bool config_matcher_add(ConfigMatcher *restrict matcher, const EdidInfo *restrict edid)
+{
+    if (matcher->num_outputs == CONFIG_MATCH_MAX_OUTPUTS) return false;
+    matcher->edids[matcher->num_outputs] = edid;
+    ConfigOutputMask bit = (ConfigOutputMask) 1 << matcher->num_outputs++;
+    char value[16];
+    match_value(value, edid->pnp_id, sizeof(edid->pnp_id));
+    match_insert(matcher->pnp, value, bit);
+    memset(value, 0, sizeof(value));
+    memcpy(value, &edid->product_id, sizeof(edid->product_id));
+    match_insert(matcher->product, value, bit);
     return true;
 }
+
+// descriptor strings are only decoded once the first row asks for a name or a serial
+static void matcher_add_strings(ConfigMatcher *matcher)
+{
+    char value[EDID_STRING_SIZE];
+    for (size_t i = 0; i < matcher->num_outputs; ++i) {
+        ConfigOutputMask bit = (ConfigOutputMask) 1 << i;
+        edid_string_copy(&matcher->edids[i]->product_name, value);
+        match_insert(matcher->name, value, bit);
+        edid_string_copy(&matcher->edids[i]->serial_number, value);
+        match_insert(matcher->serial, value, bit);
+    }
+    matcher->has_strings = true;
+}
+
+ConfigOutputMask config_matcher_match(ConfigMatcher *restrict matcher, const ConfigRow *restrict config_row)
+{
+    ConfigOutputMask mask = matcher->num_outputs == CONFIG_MATCH_MAX_OUTPUTS
+        ? ~(ConfigOutputMask) 0 : ((ConfigOutputMask) 1 << matcher->num_outputs) - 1;
+    char value[16];
+    if (config_row->has_pnp) {
+        match_value(value, config_row->pnp, sizeof(config_row->pnp));
+        mask &= match_lookup(matcher->pnp, value);
+    }
+    if (mask != 0 && config_row->has_product) {
+        memset(value, 0, sizeof(value));
+        memcpy(value, &config_row->product, sizeof(config_row->product));
+        mask &= match_lookup(matcher->product, value);
+    }
+    if (mask != 0 && (config_row->has_name || config_row->has_serial) && !matcher->has_strings) {
+        matcher_add_strings(matcher);
+    }
+    if (mask != 0 && config_row->has_name) {
+        match_value(value, config_row->name, sizeof(config_row->name));
+        mask &= match_lookup(matcher->name, value);
+    }
+    if (mask != 0 && config_row->has_serial) {
+        match_value(value, config_row->serial, sizeof(config_row->serial));
+        mask &= match_lookup(matcher->serial, value);
+    }
+    return mask;
+}
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <stddef.h>
+
+#include "edid.h"
 
 typedef struct ConfigRow {
     int      line;
@@ -19,6 +21,46 @@ typedef struct ConfigRow {
     bool     has_dpi;
 } ConfigRow;
 
-bool read_config_row(FILE *restrict stream, ConfigRow *restrict config_row);
+typedef struct ConfigFile {
+    const char *data;
+    size_t      size;
+    const char *next;
+    int         line;
+    bool        mapped;
+    bool        failed; // read_config_row stopped at a parse error rather than the end of the file
+} ConfigFile;
+
+bool config_open(ConfigFile *restrict file, const char *restrict path);
+void config_close(ConfigFile *restrict file);
+bool read_config_row(ConfigFile *restrict file, ConfigRow *restrict config_row);
+bool config_row_match(const ConfigRow *restrict config_row, const EdidInfo *restrict edid);
+
+// Matches rows against many outputs at once. Every distinct key value among the outputs maps
+// to the bitmask of outputs that carry it, so a row costs one hash lookup per key it uses
+// no matter how many outputs there are. Names and serials are only keyed once a row uses them.
+#define CONFIG_MATCH_MAX_OUTPUTS 64
+#define CONFIG_MATCH_SLOTS 128
+
+typedef uint64_t ConfigOutputMask;
+
+typedef struct ConfigMatchSlot {
+    char             value[16]; // zero padded so slots compare bytewise
+    ConfigOutputMask mask;
+    bool             used;
+} ConfigMatchSlot;
+
+typedef struct ConfigMatcher {
+    size_t           num_outputs;
+    const EdidInfo  *edids[CONFIG_MATCH_MAX_OUTPUTS]; // must outlive the matcher
+    bool             has_strings;
+    ConfigMatchSlot  pnp[CONFIG_MATCH_SLOTS];
+    ConfigMatchSlot  product[CONFIG_MATCH_SLOTS];
+    ConfigMatchSlot  name[CONFIG_MATCH_SLOTS];
+    ConfigMatchSlot  serial[CONFIG_MATCH_SLOTS];
+} ConfigMatcher;
+
+void config_matcher_init(ConfigMatcher *restrict matcher);
+bool config_matcher_add(ConfigMatcher *restrict matcher, const EdidInfo *restrict edid);
+ConfigOutputMask config_matcher_match(ConfigMatcher *restrict matcher, const ConfigRow *restrict config_row);
 
 #endif // CONFIG_H
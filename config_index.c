@@ -0,0 +1,339 @@
+#include "config_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "format.h"
+#include "log.h"
+
+static const char CONFIG_INDEX_MAGIC[8] = {'S', 'D', 'P', 'I', 'I', 'D', 'X', '\0'};
+static const uint32_t CONFIG_INDEX_VERSION = 1;
+
+typedef enum KeyMask {
+    KEY_PNP = 1u << 0u,
+    KEY_PRODUCT = 1u << 1u,
+    KEY_NAME = 1u << 2u,
+    KEY_SERIAL = 1u << 3u,
+    NumKeyMask = 1u << 4u,
+} KeyMask;
+
+typedef struct ConfigIndexKey {
+    uint16_t product;
+    uint8_t  mask;
+    char     pnp[4];
+    char     name[16];
+    char     serial[16];
+} ConfigIndexKey;
+
+struct ConfigIndexEntry {
+    uint32_t       hash;
+    int32_t        line; // 0 marks an empty slot
+    uint16_t       dpi;
+    ConfigIndexKey key;
+};
+
+struct ConfigIndexHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t key_masks; // bit N is set when some row uses key mask N
+    uint64_t source_dev;
+    uint64_t source_ino;
+    int64_t  source_size;
+    int64_t  source_mtime_sec;
+    int64_t  source_mtime_nsec;
+    uint32_t num_slots;
+    uint32_t num_entries;
+};
+
+static void copy_key_string(char *restrict dst, const char *restrict src, size_t cap)
+{
+    memcpy(dst, src, strnlen(src, cap - 1));
+}
+
+static void make_key(ConfigIndexKey *restrict key, unsigned mask,
+                     const char *pnp, uint16_t product, const char *name, const char *serial)
+{
+    // keys are hashed and compared bytewise, so padding and the tails of strings must be zero
+    memset(key, 0, sizeof(ConfigIndexKey));
+    key->mask = (uint8_t) mask;
+    if (mask & KEY_PNP) copy_key_string(key->pnp, pnp, sizeof(key->pnp));
+    if (mask & KEY_PRODUCT) key->product = product;
+    if (mask & KEY_NAME) copy_key_string(key->name, name, sizeof(key->name));
+    if (mask & KEY_SERIAL) copy_key_string(key->serial, serial, sizeof(key->serial));
+}
+
+static uint32_t hash_key(const ConfigIndexKey *key)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const uint8_t *ptr = (const uint8_t *) key;
+    for (size_t i = 0; i < sizeof(ConfigIndexKey); ++i) {
+        hash ^= ptr[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool same_source(const ConfigIndexHeader *header, const struct stat *st)
+{
+    return header->source_dev == (uint64_t) st->st_dev
+        && header->source_ino == (uint64_t) st->st_ino
+        && header->source_size == (int64_t) st->st_size
+        && header->source_mtime_sec == (int64_t) st->st_mtim.tv_sec
+        && header->source_mtime_nsec == (int64_t) st->st_mtim.tv_nsec;
+}
+
+bool config_index_path(char *restrict buf, size_t cap, const char *restrict config_path)
+{
+    int len = snprintf(buf, cap, "%s" CONFIG_INDEX_SUFFIX, config_path);
+    return len > 0 && (size_t) len < cap;
+}
+
+bool config_index_build(ConfigIndex *restrict index, const char *restrict config_path)
+{
+    memset(index, 0, sizeof(ConfigIndex));
+
+    struct stat st;
+    ConfigFile config_file;
+    if (stat(config_path, &st) != 0 || !config_open(&config_file, config_path)) {
+        LOGB(ERROR, out) {
+            fputs("failed to open config file ", out);
+            fmt_quote_string(out, config_path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        return false;
+    }
+
+    ConfigIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CONFIG_INDEX_MAGIC, sizeof(header.magic));
+    header.version = CONFIG_INDEX_VERSION;
+
+    header.source_dev = st.st_dev;
+    header.source_ino = st.st_ino;
+    header.source_size = st.st_size;
+    header.source_mtime_sec = st.st_mtim.tv_sec;
+    header.source_mtime_nsec = st.st_mtim.tv_nsec;
+
+    ConfigIndexEntry *rows = NULL;
+    size_t num_rows = 0, cap_rows = 0;
+    ConfigRow row;
+    while (read_config_row(&config_file, &row)) {
+        if (!row.has_dpi) continue;
+        if (num_rows == cap_rows) {
+            cap_rows = cap_rows ? cap_rows * 2 : 256;
+            ConfigIndexEntry *new_rows = realloc(rows, cap_rows * sizeof(ConfigIndexEntry));
+            if (new_rows == NULL) {
+                LOG(ERROR, "out of memory while compiling config index");
+                free(rows);
+                config_close(&config_file);
+                return false;
+            }
+            rows = new_rows;
+        }
+        unsigned mask = (row.has_pnp ? KEY_PNP : 0u) | (row.has_product ? KEY_PRODUCT : 0u)
+            | (row.has_name ? KEY_NAME : 0u) | (row.has_serial ? KEY_SERIAL : 0u);
+        ConfigIndexEntry *entry = &rows[num_rows++];
+        memset(entry, 0, sizeof(ConfigIndexEntry));
+        make_key(&entry->key, mask, row.pnp, row.product, row.name, row.serial);
+        entry->hash = hash_key(&entry->key);
+        entry->line = row.line;
+        entry->dpi = row.dpi;
+        header.key_masks |= 1u << mask;
+    }
+    // an index of the rows before a bad line would silently drop all the rows after it
+    if (config_file.failed) {
+        LOGB(ERROR, out) {
+            fputs("failed to compile config index: ", out);
+            fmt_quote_string(out, config_path);
+            fprintf(out, " line %d does not parse", config_file.line);
+        }
+        free(rows);
+        config_close(&config_file);
+        return false;
+    }
+    config_close(&config_file);
+
+    header.num_slots = 16;
+    while (header.num_slots < num_rows * 2) header.num_slots <<= 1u;
+    size_t size = sizeof(ConfigIndexHeader) + (size_t) header.num_slots * sizeof(ConfigIndexEntry);
+    ConfigIndexHeader *block = calloc(1, size);
+    if (block == NULL) {
+        LOG(ERROR, "out of memory while compiling config index");
+        free(rows);
+        return false;
+    }
+    ConfigIndexEntry *slots = (ConfigIndexEntry *) (block + 1);
+
+    // rows are inserted in file order, so a later row with the same key replaces the earlier one
+    uint32_t slot_mask = header.num_slots - 1;
+    for (size_t i = 0; i < num_rows; ++i) {
+        uint32_t slot = rows[i].hash & slot_mask;
+        while (slots[slot].line != 0
+               && !(slots[slot].hash == rows[i].hash && memcmp(&slots[slot].key, &rows[i].key, sizeof(ConfigIndexKey)) == 0)) {
+            slot = (slot + 1) & slot_mask;
+        }
+        if (slots[slot].line == 0) ++header.num_entries;
+        slots[slot] = rows[i];
+    }
+    free(rows);
+    *block = header;
+
+    index->header = block;
+    index->entries = slots;
+    index->map_size = size;
+    index->mapped = false;
+    LOG(DEBUG, "config index: %u entries in %u slots", header.num_entries, header.num_slots);
+    return true;
+}
+
+bool config_index_compile(const char *restrict config_path, const char *restrict index_path)
+{
+    ConfigIndex index;
+    if (!config_index_build(&index, config_path)) {
+        return false;
+    }
+
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path) >= (int) sizeof(tmp_path)) {
+        LOG(ERROR, "config index path is too long");
+        config_index_close(&index);
+        return false;
+    }
+    FILE *index_file = fopen(tmp_path, "wb");
+    if (index_file == NULL) {
+        LOGB(ERROR, out) {
+            fputs("failed to create config index ", out);
+            fmt_quote_string(out, tmp_path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        config_index_close(&index);
+        return false;
+    }
+    bool ok = fwrite(index.header, index.map_size, 1, index_file) == 1;
+    ok = (fclose(index_file) == 0) && ok;
+    config_index_close(&index);
+    if (!ok || rename(tmp_path, index_path) != 0) {
+        LOGB(ERROR, out) {
+            fputs("failed to write config index ", out);
+            fmt_quote_string(out, index_path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        unlink(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+bool config_index_open(ConfigIndex *restrict index, const char *restrict index_path, const char *restrict config_path)
+{
+    memset(index, 0, sizeof(ConfigIndex));
+    // library callers run without an index
+    if (index_path == NULL) return false;
+
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            LOG(WARN, "failed to open config index: %s", strerror(errno));
+        }
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ConfigIndexHeader)) {
+        LOG(WARN, "config index is truncated");
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG(WARN, "failed to map config index: %s", strerror(errno));
+        return false;
+    }
+
+    const ConfigIndexHeader *header = map;
+    bool valid = memcmp(header->magic, CONFIG_INDEX_MAGIC, sizeof(header->magic)) == 0
+        && header->version == CONFIG_INDEX_VERSION
+        && header->num_slots != 0
+        && (header->num_slots & (header->num_slots - 1)) == 0
+        && header->num_entries < header->num_slots // lookups stop at the first empty slot
+        && (size_t) st.st_size == sizeof(ConfigIndexHeader) + (size_t) header->num_slots * sizeof(ConfigIndexEntry);
+    if (!valid) {
+        LOG(WARN, "config index is corrupted, ignoring it");
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    struct stat config_st;
+    if (stat(config_path, &config_st) != 0 || !same_source(header, &config_st)) {
+        LOG(WARN, "config index is stale, run with --compile to update it");
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    index->header = header;
+    index->entries = (const ConfigIndexEntry *) (header + 1);
+    index->map_size = st.st_size;
+    index->mapped = true;
+    return true;
+}
+
+bool config_index_lookup(const ConfigIndex *restrict index, const EdidInfo *restrict edid, uint16_t *restrict dpi)
+{
+    uint32_t slot_mask = index->header->num_slots - 1;
+    int32_t best_line = 0;
+    char name[EDID_STRING_SIZE] = "";
+    char serial[EDID_STRING_SIZE] = "";
+    bool has_strings = false;
+
+    for (unsigned mask = 0; mask < NumKeyMask; ++mask) {
+        if (!(index->header->key_masks & (1u << mask))) continue;
+
+        // descriptor strings are decoded only when the index has a row keyed on them
+        if ((mask & (KEY_NAME | KEY_SERIAL)) && !has_strings) {
+            edid_string_copy(&edid->product_name, name);
+            edid_string_copy(&edid->serial_number, serial);
+            has_strings = true;
+        }
+        ConfigIndexKey key;
+        make_key(&key, mask, edid->pnp_id, edid->product_id, name, serial);
+        uint32_t hash = hash_key(&key);
+        // bounded, so a damaged index without an empty slot cannot keep the probe going forever
+        uint32_t slot = hash & slot_mask;
+        for (uint32_t probes = 0; probes <= slot_mask && index->entries[slot].line != 0; ++probes, slot = (slot + 1) & slot_mask) {
+            const ConfigIndexEntry *entry = &index->entries[slot];
+            if (entry->hash != hash || memcmp(&entry->key, &key, sizeof(ConfigIndexKey)) != 0) continue;
+            if (entry->line > best_line) {
+                best_line = entry->line;
+                *dpi = entry->dpi;
+            }
+            break;
+        }
+    }
+
+    if (best_line != 0) {
+        LOG(DEBUG, "config index: matched line %d, dpi=%u", best_line, *dpi);
+    }
+    return best_line != 0;
+}
+
+void config_index_close(ConfigIndex *restrict index)
+{
+    if (index == NULL) return;
+    if (index->header == NULL) return;
+    if (index->mapped) {
+        munmap((void *) index->header, index->map_size);
+    } else {
+        free((void *) index->header);
+    }
+    memset(index, 0, sizeof(ConfigIndex));
+}
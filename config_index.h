@@ -0,0 +1,34 @@
+#ifndef CONFIG_INDEX_H
+#define CONFIG_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edid.h"
+
+// Precompiled form of the text config: one open-addressing hash table whose
+// entries are keyed on the set of keys a row uses (pnp/product/name/serial)
+// plus their values. The file is written in host byte order and is meant to
+// live next to the config it was compiled from.
+
+#define CONFIG_INDEX_SUFFIX ".idx"
+
+typedef struct ConfigIndexHeader ConfigIndexHeader;
+typedef struct ConfigIndexEntry ConfigIndexEntry;
+
+typedef struct ConfigIndex {
+    const ConfigIndexHeader *header;
+    const ConfigIndexEntry  *entries;
+    size_t                   map_size;
+    bool                     mapped;
+} ConfigIndex;
+
+bool config_index_path(char *restrict buf, size_t cap, const char *restrict config_path);
+bool config_index_build(ConfigIndex *restrict index, const char *restrict config_path);
+bool config_index_compile(const char *restrict config_path, const char *restrict index_path);
+bool config_index_open(ConfigIndex *restrict index, const char *restrict index_path, const char *restrict config_path);
+bool config_index_lookup(const ConfigIndex *restrict index, const EdidInfo *restrict edid, uint16_t *restrict dpi);
+void config_index_close(ConfigIndex *restrict index);
+
+#endif // CONFIG_INDEX_H
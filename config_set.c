@@ -0,0 +1,418 @@
+#include "config_set.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "log.h"
+
+static const char RULES_CACHE_MAGIC[8] = {'S', 'D', 'P', 'I', 'R', 'U', 'L', '\0'};
+static const uint32_t RULES_CACHE_VERSION = 1;
+
+#define CONFIG_SET_MAX_THREADS 16
+
+typedef struct RulesCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t row_size;
+    uint64_t num_entries;
+    uint64_t num_rows;
+} RulesCacheHeader;
+
+typedef struct RulesCacheEntry {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t first_row;
+    uint64_t num_rows;
+} RulesCacheEntry;
+
+typedef struct ParseQueue {
+    pthread_mutex_t lock;
+    ConfigSource  **sources;
+    size_t          num_sources;
+    size_t          next;
+    LogContext     *log; // the caller's, workers log through it too
+} ParseQueue;
+
+static bool rules_cache_path(char *restrict buf, size_t cap)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || *runtime_dir == '\0') return false;
+    int len = snprintf(buf, cap, "%s/suggestdpi-rules.cache", runtime_dir);
+    return len > 0 && (size_t) len < cap;
+}
+
+static bool add_source(ConfigSet *restrict set, const char *restrict path, size_t *restrict cap)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return true;
+    }
+    if (set->num_sources == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 16;
+        ConfigSource *sources = realloc(set->sources, new_cap * sizeof(ConfigSource));
+        if (sources == NULL) return false;
+        set->sources = sources;
+        *cap = new_cap;
+    }
+    ConfigSource *source = &set->sources[set->num_sources];
+    memset(source, 0, sizeof(ConfigSource));
+    source->path = strdup(path);
+    if (source->path == NULL) return false;
+    source->dev = st.st_dev;
+    source->ino = st.st_ino;
+    source->size = st.st_size;
+    source->mtime_sec = st.st_mtim.tv_sec;
+    source->mtime_nsec = st.st_mtim.tv_nsec;
+    ++set->num_sources;
+    return true;
+}
+
+static int is_drop_in(const struct dirent *entry)
+{
+    size_t len = strlen(entry->d_name);
+    size_t suffix_len = sizeof(CONFIG_SET_SUFFIX) - 1;
+    return entry->d_name[0] != '.' && len > suffix_len
+        && strcmp(entry->d_name + len - suffix_len, CONFIG_SET_SUFFIX) == 0;
+}
+
+// bytewise rather than alphasort's strcoll, the merge order must not depend on the locale
+static int compare_names(const struct dirent **lhs, const struct dirent **rhs)
+{
+    return strcmp((*lhs)->d_name, (*rhs)->d_name);
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+    // FNV-1a
+    const uint8_t *ptr = data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= ptr[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+bool config_set_scan(ConfigSet *restrict set, const char *restrict config_path, const char *restrict config_dir)
+{
+    memset(set, 0, sizeof(ConfigSet));
+    size_t cap = 0;
+    if (!add_source(set, config_path, &cap)) {
+        LOG(ERROR, "out of memory while listing config files");
+        config_set_free(set);
+        return false;
+    }
+    size_t num_main = set->num_sources;
+
+    struct dirent **entries = NULL;
+    int num_entries = config_dir ? scandir(config_dir, &entries, is_drop_in, compare_names) : 0;
+    if (num_entries < 0) {
+        if (errno != ENOENT) {
+            LOGB(WARN, out) {
+                fputs("failed to list config directory ", out);
+                fmt_quote_string(out, config_dir);
+                fprintf(out, ": %s", strerror(errno));
+            }
+        }
+        num_entries = 0;
+    }
+    bool ok = true;
+    for (int i = 0; i < num_entries; ++i) {
+        char path[PATH_MAX];
+        if (ok && snprintf(path, sizeof(path), "%s/%s", config_dir, entries[i]->d_name) < (int) sizeof(path)) {
+            ok = add_source(set, path, &cap);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    if (!ok) {
+        LOG(ERROR, "out of memory while listing config files");
+        config_set_free(set);
+        return false;
+    }
+    set->num_drop_ins = set->num_sources - num_main;
+
+    uint64_t stamp = 14695981039346656037u;
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        const ConfigSource *source = &set->sources[i];
+        stamp = hash_bytes(stamp, source->path, strlen(source->path) + 1);
+        stamp = hash_bytes(stamp, &source->dev, sizeof(source->dev));
+        stamp = hash_bytes(stamp, &source->ino, sizeof(source->ino));
+        stamp = hash_bytes(stamp, &source->size, sizeof(source->size));
+        stamp = hash_bytes(stamp, &source->mtime_sec, sizeof(source->mtime_sec));
+        stamp = hash_bytes(stamp, &source->mtime_nsec, sizeof(source->mtime_nsec));
+    }
+    set->stamp = stamp;
+    return true;
+}
+
+uint64_t config_set_stamp(const char *restrict config_path, const char *restrict config_dir)
+{
+    ConfigSet set;
+    if (!config_set_scan(&set, config_path, config_dir)) return 0;
+    uint64_t stamp = set.stamp;
+    config_set_free(&set);
+    return stamp;
+}
+
+static int compare_entries(const void *lhs, const void *rhs)
+{
+    const RulesCacheEntry *a = lhs, *b = rhs;
+    if (a->dev != b->dev) return a->dev < b->dev ? -1 : 1;
+    if (a->ino != b->ino) return a->ino < b->ino ? -1 : 1;
+    return 0;
+}
+
+static void map_rules_cache(ConfigSet *restrict set)
+{
+    char path[PATH_MAX];
+    if (!rules_cache_path(path, sizeof(path))) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(RulesCacheHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    const RulesCacheHeader *header = map;
+    bool valid = memcmp(header->magic, RULES_CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == RULES_CACHE_VERSION
+        && header->row_size == sizeof(ConfigRow)
+        && header->num_entries <= (size_t) st.st_size / sizeof(RulesCacheEntry)
+        && header->num_rows <= (size_t) st.st_size / sizeof(ConfigRow)
+        && (size_t) st.st_size == sizeof(RulesCacheHeader) + header->num_entries * sizeof(RulesCacheEntry)
+                                  + header->num_rows * sizeof(ConfigRow);
+    if (!valid) {
+        LOG(DEBUG, "config: ignoring invalid parse cache");
+        munmap(map, st.st_size);
+        return;
+    }
+    set->cache_map = map;
+    set->cache_size = st.st_size;
+}
+
+static void lookup_rules_cache(ConfigSet *restrict set)
+{
+    if (set->cache_map == NULL) return;
+    const RulesCacheHeader *header = set->cache_map;
+    const RulesCacheEntry *entries = (const RulesCacheEntry *) (header + 1);
+    const ConfigRow *rows = (const ConfigRow *) (entries + header->num_entries);
+
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        ConfigSource *source = &set->sources[i];
+        RulesCacheEntry key = {source->dev, source->ino, 0, 0, 0, 0, 0};
+        const RulesCacheEntry *entry = bsearch(&key, entries, header->num_entries, sizeof(RulesCacheEntry),
+                                               compare_entries);
+        if (entry == NULL || entry->size != source->size || entry->mtime_sec != source->mtime_sec
+            || entry->mtime_nsec != source->mtime_nsec || entry->first_row + entry->num_rows > header->num_rows) {
+            continue;
+        }
+        source->rows = rows + entry->first_row;
+        source->num_rows = entry->num_rows;
+    }
+}
+
+static bool parse_source(ConfigSource *source)
+{
+    ConfigFile file;
+    if (!config_open(&file, source->path)) {
+        LOGB(WARN, out) {
+            fputs("failed to open config file ", out);
+            fmt_quote_string(out, source->path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        return false;
+    }
+    ConfigRow *rows = NULL;
+    size_t num_rows = 0, cap_rows = 0;
+    ConfigRow row;
+    bool ok = true;
+    while (read_config_row(&file, &row)) {
+        // a row without a dpi can never change the result, it is not worth keeping
+        if (!row.has_dpi) continue;
+        if (num_rows == cap_rows) {
+            cap_rows = cap_rows ? cap_rows * 2 : 64;
+            ConfigRow *new_rows = realloc(rows, cap_rows * sizeof(ConfigRow));
+            if (new_rows == NULL) {
+                ok = false;
+                break;
+            }
+            rows = new_rows;
+        }
+        rows[num_rows++] = row;
+    }
+    config_close(&file);
+    if (!ok) {
+        LOG(ERROR, "out of memory while parsing config");
+        free(rows);
+        return false;
+    }
+    source->rows = rows;
+    source->num_rows = num_rows;
+    source->owned = true;
+    return true;
+}
+
+static void *parse_worker(void *arg)
+{
+    ParseQueue *queue = arg;
+    log_use_context(queue->log);
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t next = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (next >= queue->num_sources) break;
+        parse_source(queue->sources[next]);
+    }
+    return NULL;
+}
+
+static void parse_sources(ConfigSource **sources, size_t num_sources)
+{
+    ParseQueue queue = {PTHREAD_MUTEX_INITIALIZER, sources, num_sources, 0, log_context};
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = num_cpus > 1 ? (size_t) num_cpus : 1;
+    if (num_threads > CONFIG_SET_MAX_THREADS) num_threads = CONFIG_SET_MAX_THREADS;
+    if (num_threads > num_sources) num_threads = num_sources;
+
+    // the calling thread is one of the workers
+    pthread_t threads[CONFIG_SET_MAX_THREADS];
+    size_t started = 0;
+    for (; started + 1 < num_threads; ++started) {
+        if (pthread_create(&threads[started], NULL, parse_worker, &queue) != 0) break;
+    }
+    parse_worker(&queue);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+}
+
+static void store_rules_cache(const ConfigSet *restrict set)
+{
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    if (!rules_cache_path(path, sizeof(path))) return;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int) sizeof(tmp_path)) return;
+
+    RulesCacheEntry *entries = calloc(set->num_sources ? set->num_sources : 1, sizeof(RulesCacheEntry));
+    size_t *order = calloc(set->num_sources ? set->num_sources : 1, sizeof(size_t));
+    if (entries == NULL || order == NULL) {
+        free(entries);
+        free(order);
+        return;
+    }
+    RulesCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RULES_CACHE_MAGIC, sizeof(header.magic));
+    header.version = RULES_CACHE_VERSION;
+    header.row_size = sizeof(ConfigRow);
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        const ConfigSource *source = &set->sources[i];
+        if (source->rows == NULL && source->num_rows == 0 && !source->owned) continue;
+        RulesCacheEntry *entry = &entries[header.num_entries];
+        entry->dev = source->dev;
+        entry->ino = source->ino;
+        entry->size = source->size;
+        entry->mtime_sec = source->mtime_sec;
+        entry->mtime_nsec = source->mtime_nsec;
+        entry->first_row = i; // replaced by the row offset once sorted
+        entry->num_rows = source->num_rows;
+        ++header.num_entries;
+    }
+    qsort(entries, header.num_entries, sizeof(RulesCacheEntry), compare_entries);
+    for (size_t i = 0; i < header.num_entries; ++i) {
+        order[i] = entries[i].first_row;
+        entries[i].first_row = header.num_rows;
+        header.num_rows += entries[i].num_rows;
+    }
+
+    // a unique temporary file, other threads and processes may be storing the cache right now
+    FILE *cache_file = NULL;
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOG(DEBUG, "config: failed to create parse cache: %s", strerror(errno));
+        free(entries);
+        free(order);
+        return;
+    }
+    cache_file = fdopen(fd, "wb");
+    bool ok = cache_file != NULL
+        && fwrite(&header, sizeof(header), 1, cache_file) == 1
+        && fwrite(entries, sizeof(RulesCacheEntry), header.num_entries, cache_file) == header.num_entries;
+    for (size_t i = 0; ok && i < header.num_entries; ++i) {
+        const ConfigSource *source = &set->sources[order[i]];
+        ok = fwrite(source->rows, sizeof(ConfigRow), source->num_rows, cache_file) == source->num_rows;
+    }
+    if (cache_file != NULL) {
+        ok = (fclose(cache_file) == 0) && ok;
+    } else {
+        close(fd);
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        LOG(DEBUG, "config: failed to write parse cache: %s", strerror(errno));
+        unlink(tmp_path);
+    }
+    free(entries);
+    free(order);
+}
+
+bool config_set_load(ConfigSet *restrict set)
+{
+    map_rules_cache(set);
+    lookup_rules_cache(set);
+
+    ConfigSource **stale = calloc(set->num_sources ? set->num_sources : 1, sizeof(ConfigSource *));
+    if (stale == NULL) {
+        LOG(ERROR, "out of memory while loading config");
+        return false;
+    }
+    size_t num_stale = 0;
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        if (set->sources[i].rows == NULL) stale[num_stale++] = &set->sources[i];
+    }
+    LOG(DEBUG, "config: %zu files, %zu parsed, %zu from the parse cache", set->num_sources, num_stale,
+        set->num_sources - num_stale);
+    if (num_stale > 0) {
+        parse_sources(stale, num_stale);
+    }
+    free(stale);
+
+    // a run that parsed nothing and found every file in the cache leaves it alone
+    bool rewrite = num_stale > 0;
+    if (set->cache_map != NULL) {
+        const RulesCacheHeader *header = set->cache_map;
+        rewrite = rewrite || header->num_entries != set->num_sources;
+    }
+    if (rewrite || set->cache_map == NULL) {
+        store_rules_cache(set);
+    }
+    return true;
+}
+
+void config_set_free(ConfigSet *restrict set)
+{
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        free(set->sources[i].path);
+        if (set->sources[i].owned) free((void *) set->sources[i].rows);
+    }
+    free(set->sources);
+    if (set->cache_map != NULL) {
+        munmap(set->cache_map, set->cache_size);
+    }
+    memset(set, 0, sizeof(ConfigSet));
+}
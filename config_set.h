@@ -0,0 +1,46 @@
+#ifndef CONFIG_SET_H
+#define CONFIG_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+// The main config plus the *.conf files of a drop-in directory, in merge order: the main
+// config first, then the drop-ins sorted bytewise by name. Rows are evaluated in that order,
+// so a later file overrides an earlier one just like a later line does within a file.
+//
+// Parsed rows are kept in $XDG_RUNTIME_DIR/suggestdpi-rules.cache keyed on the device, inode,
+// size and mtime of each file; only files that changed since the last run are parsed again,
+// and those are parsed in parallel.
+
+#define CONFIG_SET_SUFFIX ".conf"
+
+typedef struct ConfigSource {
+    char            *path;
+    uint64_t         dev;
+    uint64_t         ino;
+    int64_t          size;
+    int64_t          mtime_sec;
+    int64_t          mtime_nsec;
+    const ConfigRow *rows;
+    size_t           num_rows;
+    bool             owned; // rows were parsed here rather than mapped from the parse cache
+} ConfigSource;
+
+typedef struct ConfigSet {
+    ConfigSource *sources;
+    size_t        num_sources;
+    size_t        num_drop_ins;
+    uint64_t      stamp; // changes whenever a file is added, removed or modified
+    void         *cache_map;
+    size_t        cache_size;
+} ConfigSet;
+
+bool config_set_scan(ConfigSet *restrict set, const char *restrict config_path, const char *restrict config_dir);
+bool config_set_load(ConfigSet *restrict set);
+void config_set_free(ConfigSet *restrict set);
+uint64_t config_set_stamp(const char *restrict config_path, const char *restrict config_dir);
+
+#endif // CONFIG_SET_H
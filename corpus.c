@@ -0,0 +1,474 @@
+#include "corpus.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config_index.h"
+#include "dpi.h"
+#include "edid.h"
+#include "format.h"
+#include "log.h"
+
+// the largest EDID there can be, 256 blocks of 128 bytes; larger blobs are skipped
+#define CORPUS_MAX_BLOB 32768
+#define TAR_BLOCK 512
+
+typedef struct CorpusJob {
+    char  *name;
+    Buffer data; // members of a tar archive point into its mapping, plain files are read by the worker
+} CorpusJob;
+
+typedef struct CorpusMapping {
+    void  *ptr;
+    size_t len;
+} CorpusMapping;
+
+typedef struct Corpus {
+    CorpusJob     *jobs;
+    size_t         num_jobs;
+    size_t         cap_jobs;
+    CorpusMapping *mappings;
+    size_t         num_mappings;
+    size_t         cap_mappings;
+    ConfigIndex    index;
+    bool           has_index;
+    pthread_mutex_t out_lock;
+} Corpus;
+
+// every worker owns a range of job indices, idle workers steal half of someone else's range
+typedef struct Worker {
+    Corpus         *corpus;
+    struct Worker  *workers;
+    unsigned        id;
+    unsigned        num_workers;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    size_t          begin;
+    size_t          end;
+    FILE           *out;
+    char           *out_buf;
+    size_t          out_len;
+    size_t          validity[EDID_BAD_CHECKSUM + 1];
+    size_t          oversized;
+    uint32_t       *histogram;
+} Worker;
+
+static bool push_job(Corpus *corpus, char *name, Buffer data)
+{
+    if (corpus->num_jobs == corpus->cap_jobs) {
+        size_t cap = corpus->cap_jobs ? corpus->cap_jobs * 2 : 1024;
+        CorpusJob *jobs = realloc(corpus->jobs, cap * sizeof(CorpusJob));
+        if (jobs == NULL) {
+            free(name);
+            return false;
+        }
+        corpus->jobs = jobs;
+        corpus->cap_jobs = cap;
+    }
+    corpus->jobs[corpus->num_jobs].name = name;
+    corpus->jobs[corpus->num_jobs].data = data;
+    ++corpus->num_jobs;
+    return true;
+}
+
+static char *join_path(const char *dir, const char *sep, const char *name, size_t name_len)
+{
+    size_t dir_len = strlen(dir), sep_len = strlen(sep);
+    char *path = malloc(dir_len + sep_len + name_len + 1);
+    if (path == NULL) return NULL;
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, sep, sep_len);
+    memcpy(path + dir_len + sep_len, name, name_len);
+    path[dir_len + sep_len + name_len] = '\0';
+    return path;
+}
+
+static bool has_suffix(const char *str, const char *suffix)
+{
+    size_t len = strlen(str), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+static size_t parse_octal(const uint8_t *ptr, size_t len)
+{
+    size_t val = 0;
+    for (size_t i = 0; i < len && ptr[i] >= '0' && ptr[i] <= '7'; ++i) {
+        val = val * 8 + (ptr[i] - '0');
+    }
+    return val;
+}
+
+static bool add_tar(Corpus *corpus, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG(WARN, "corpus: failed to open %s: %s", path, strerror(errno));
+        return true;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG(WARN, "corpus: failed to map %s: %s", path, strerror(errno));
+        return true;
+    }
+    if (corpus->num_mappings == corpus->cap_mappings) {
+        size_t cap = corpus->cap_mappings ? corpus->cap_mappings * 2 : 16;
+        CorpusMapping *mappings = realloc(corpus->mappings, cap * sizeof(CorpusMapping));
+        if (mappings == NULL) {
+            munmap(map, st.st_size);
+            return false;
+        }
+        corpus->mappings = mappings;
+        corpus->cap_mappings = cap;
+    }
+    corpus->mappings[corpus->num_mappings].ptr = map;
+    corpus->mappings[corpus->num_mappings].len = st.st_size;
+    ++corpus->num_mappings;
+
+    const uint8_t *data = map;
+    size_t size = st.st_size;
+    for (size_t offset = 0; offset + TAR_BLOCK <= size;) {
+        const uint8_t *header = data + offset;
+        if (header[0] == '\0') break;
+        size_t member_size = parse_octal(header + 124, 12);
+        uint8_t type = header[156];
+        size_t data_offset = offset + TAR_BLOCK;
+        offset = data_offset + (member_size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+        if (type != '0' && type != '\0') continue;
+        if (data_offset + member_size > size) {
+            LOG(WARN, "corpus: %s is truncated", path);
+            break;
+        }
+
+        char member[256 + 2];
+        size_t member_len = 0;
+        if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+            member_len = strnlen((const char *) header + 345, 155);
+            memcpy(member, header + 345, member_len);
+            member[member_len++] = '/';
+        }
+        size_t name_len = strnlen((const char *) header, 100);
+        memcpy(member + member_len, header, name_len);
+        member_len += name_len;
+
+        char *name = join_path(path, ":", member, member_len);
+        Buffer blob = {data + data_offset, member_size};
+        if (name == NULL || !push_job(corpus, name, blob)) return false;
+    }
+    return true;
+}
+
+static bool add_path(Corpus *corpus, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        LOG(WARN, "corpus: failed to stat %s: %s", path, strerror(errno));
+        return true;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (has_suffix(path, ".tar")) {
+            return add_tar(corpus, path);
+        }
+        char *name = join_path(path, "", "", 0);
+        Buffer none = {NULL, 0};
+        return name != NULL && push_job(corpus, name, none);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return true;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        LOG(WARN, "corpus: failed to open %s: %s", path, strerror(errno));
+        return true;
+    }
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char *child = join_path(path, "/", entry->d_name, strlen(entry->d_name));
+        if (child == NULL) {
+            ok = false;
+            break;
+        }
+        ok = add_path(corpus, child);
+        free(child);
+    }
+    closedir(dir);
+    return ok;
+}
+
+static bool pop_job(Worker *worker, size_t *job)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->begin < worker->end) {
+        *job = worker->begin++;
+        pthread_mutex_unlock(&worker->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (unsigned i = 1; i < worker->num_workers; ++i) {
+        Worker *victim = &worker->workers[(worker->id + i) % worker->num_workers];
+        size_t begin = 0, end = 0;
+        pthread_mutex_lock(&victim->lock);
+        size_t remaining = victim->end - victim->begin;
+        if (remaining > 0) {
+            size_t take = (remaining + 1) / 2;
+            end = victim->end;
+            begin = end - take;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (begin == end) continue;
+
+        *job = begin;
+        pthread_mutex_lock(&worker->lock);
+        worker->begin = begin + 1;
+        worker->end = end;
+        pthread_mutex_unlock(&worker->lock);
+        return true;
+    }
+    return false;
+}
+
+// every record goes out as soon as it is done, whole so that workers never interleave
+static void flush_output(Worker *worker)
+{
+    fflush(worker->out);
+    if (worker->out_len == 0) return;
+    pthread_mutex_lock(&worker->corpus->out_lock);
+    fwrite(worker->out_buf, 1, worker->out_len, stdout);
+    pthread_mutex_unlock(&worker->corpus->out_lock);
+    rewind(worker->out);
+    fflush(worker->out);
+}
+
+static size_t read_blob(const char *path, uint8_t *buf, size_t cap)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    size_t len = 0;
+    while (len < cap) {
+        ssize_t got = read(fd, buf + len, cap - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        len += got;
+    }
+    close(fd);
+    return len;
+}
+
+static void analyze_job(Worker *worker, const CorpusJob *job)
+{
+    // one byte more than a blob may have, so that an oversized file is not read as a short one
+    static __thread uint8_t blob[CORPUS_MAX_BLOB + 1];
+    Buffer data = job->data;
+    if (data.ptr == NULL) {
+        data.len = read_blob(job->name, blob, sizeof(blob));
+        data.ptr = blob;
+    }
+    if (data.len > CORPUS_MAX_BLOB) {
+        LOGB(WARN, out) {
+            fputs("corpus: skipping ", out);
+            fmt_quote_string(out, job->name);
+            fprintf(out, ", it is larger than %d bytes", CORPUS_MAX_BLOB);
+        }
+        ++worker->oversized;
+        return;
+    }
+
+    FILE *out = worker->out;
+    EdidValidity validity = validate_edid(data);
+    ++worker->validity[validity];
+    fmt_quote_string(out, job->name);
+    fprintf(out, " %s", edid_validity_name(validity));
+
+    EdidInfo edid;
+    if (validity == EDID_TRUNCATED || validity == EDID_BAD_HEADER || !parse_edid(data, &edid)) {
+        fputc('\n', out);
+        flush_output(worker);
+        return;
+    }
+    uint16_t mode_width, mode_height;
+    read_edid_mode(data, &mode_width, &mode_height);
+
+    uint16_t dpi = 0;
+    const char *source = "config";
+    if (!worker->corpus->has_index || !config_index_lookup(&worker->corpus->index, &edid, &dpi) || dpi == 0) {
+        source = "edid";
+        if (edid.physical_width != 0 && edid.physical_height != 0 && mode_width != 0 && mode_height != 0) {
+            dpi = dpi_from_size(mode_width, mode_height, edid.physical_width, edid.physical_height);
+        }
+    }
+    ++worker->histogram[dpi];
+
+    fputs(" pnp=", out);
+    fmt_quote_string(out, edid.pnp_id);
+    fprintf(out, " product=0x%04" PRIx16, edid.product_id);
+    fputs(" name=", out);
+    edid_string_quote(out, &edid.product_name);
+    fputs(" serial=", out);
+    edid_string_quote(out, &edid.serial_number);
+    fprintf(out, " size=%ux%u mode=%ux%u", edid.physical_width, edid.physical_height, mode_width, mode_height);
+    if (dpi != 0) {
+        fprintf(out, " dpi=%u source=%s\n", dpi, source);
+    } else {
+        fputs(" dpi=unknown\n", out);
+    }
+    flush_output(worker);
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    size_t job;
+    while (pop_job(worker, &job)) {
+        analyze_job(worker, &worker->corpus->jobs[job]);
+    }
+    return NULL;
+}
+
+static void print_summary(const Corpus *corpus, const Worker *workers, unsigned num_workers)
+{
+    size_t validity[EDID_BAD_CHECKSUM + 1] = {0};
+    size_t oversized = 0;
+    size_t max_count = 0;
+    uint32_t *histogram = workers[0].histogram;
+    for (unsigned i = 0; i < num_workers; ++i) {
+        for (int j = 0; j <= EDID_BAD_CHECKSUM; ++j) {
+            validity[j] += workers[i].validity[j];
+        }
+        oversized += workers[i].oversized;
+        for (size_t dpi = 0; i != 0 && dpi <= UINT16_MAX; ++dpi) {
+            histogram[dpi] += workers[i].histogram[dpi];
+        }
+    }
+    for (size_t dpi = 0; dpi <= UINT16_MAX; ++dpi) {
+        if (histogram[dpi] > max_count) max_count = histogram[dpi];
+    }
+
+    fprintf(stderr, "blobs: %zu", corpus->num_jobs);
+    for (int j = 0; j <= EDID_BAD_CHECKSUM; ++j) {
+        fprintf(stderr, ", %s: %zu", edid_validity_name((EdidValidity) j), validity[j]);
+    }
+    fprintf(stderr, ", oversized: %zu", oversized);
+    fputs("\ndpi histogram:\n", stderr);
+    for (size_t dpi = 0; dpi <= UINT16_MAX; ++dpi) {
+        if (histogram[dpi] == 0) continue;
+        int bar = (int) ((uint64_t) histogram[dpi] * 50 / max_count);
+        if (dpi == 0) {
+            fprintf(stderr, "  unknown %10" PRIu32 " ", histogram[dpi]);
+        } else {
+            fprintf(stderr, "  %7zu %10" PRIu32 " ", dpi, histogram[dpi]);
+        }
+        for (int i = 0; i < bar; ++i) fputc('#', stderr);
+        fputc('\n', stderr);
+    }
+}
+
+bool corpus_analyze(char *const paths[], size_t num_paths, const char *config_path, const char *index_path,
+                    unsigned num_threads)
+{
+    static Corpus corpus;
+    memset(&corpus, 0, sizeof(corpus));
+    pthread_mutex_init(&corpus.out_lock, NULL);
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < num_paths; ++i) {
+        ok = add_path(&corpus, paths[i]);
+    }
+    if (!ok) {
+        LOG(ERROR, "corpus: out of memory while collecting blobs");
+    }
+
+    // without a config every dpi comes from the EDID, that is not worth an error
+    struct stat config_st;
+    if (ok && stat(config_path, &config_st) == 0) {
+        corpus.has_index = config_index_open(&corpus.index, index_path, config_path)
+            || config_index_build(&corpus.index, config_path);
+    } else if (ok) {
+        LOG(DEBUG, "corpus: no config at %s, matching is skipped", config_path);
+    }
+
+    if (num_threads == 0) num_threads = 1;
+    if (num_threads > corpus.num_jobs && corpus.num_jobs > 0) num_threads = corpus.num_jobs;
+    Worker *workers = ok ? calloc(num_threads, sizeof(Worker)) : NULL;
+    if (ok && workers == NULL) {
+        LOG(ERROR, "corpus: out of memory");
+        ok = false;
+    }
+
+    unsigned started = 0;
+    for (unsigned i = 0; ok && i < num_threads; ++i) {
+        Worker *worker = &workers[i];
+        worker->corpus = &corpus;
+        worker->workers = workers;
+        worker->id = i;
+        worker->num_workers = num_threads;
+        worker->begin = corpus.num_jobs * i / num_threads;
+        worker->end = corpus.num_jobs * (i + 1) / num_threads;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->out = open_memstream(&worker->out_buf, &worker->out_len);
+        worker->histogram = calloc(UINT16_MAX + 1, sizeof(uint32_t));
+        if (worker->out == NULL || worker->histogram == NULL) {
+            LOG(ERROR, "corpus: out of memory");
+            ok = false;
+        }
+    }
+    for (unsigned i = 0; ok && i < num_threads; ++i) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            LOG(ERROR, "corpus: failed to start worker thread");
+            // the started workers steal the remaining ranges
+            break;
+        }
+        ++started;
+    }
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (ok && started == 0) {
+        ok = false;
+    }
+    fflush(stdout);
+
+    if (ok) {
+        print_summary(&corpus, workers, num_threads);
+    }
+
+    for (unsigned i = 0; workers != NULL && i < num_threads; ++i) {
+        if (workers[i].out) fclose(workers[i].out);
+        free(workers[i].out_buf);
+        free(workers[i].histogram);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    free(workers);
+    if (corpus.has_index) {
+        config_index_close(&corpus.index);
+    }
+    for (size_t i = 0; i < corpus.num_jobs; ++i) {
+        free(corpus.jobs[i].name);
+    }
+    free(corpus.jobs);
+    for (size_t i = 0; i < corpus.num_mappings; ++i) {
+        munmap(corpus.mappings[i].ptr, corpus.mappings[i].len);
+    }
+    free(corpus.mappings);
+    pthread_mutex_destroy(&corpus.out_lock);
+    return ok;
+}
@@ -0,0 +1,15 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Offline analysis of raw EDID blobs: every path is a file, a directory
+// (walked recursively) or an uncompressed tar archive. Each blob yields one
+// result line on stdout as soon as it is analyzed, a summary with a dpi
+// histogram goes to stderr. Blobs larger than any EDID are skipped with a
+// warning and counted as oversized.
+bool corpus_analyze(char *const paths[], size_t num_paths, const char *config_path, const char *index_path,
+                    unsigned num_threads);
+
+#endif // CORPUS_H
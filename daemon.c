@@ -0,0 +1,234 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config_set.h"
+#include "dpi.h"
+#include "dpi_shm.h"
+#include "format.h"
+#include "log.h"
+#include "screen_info.h"
+
+typedef struct DaemonState {
+    const char *config_path;
+    const char *config_dir;
+    const char *index_path;
+    uint64_t    config_stamp;
+    const char *shm_name;
+    DpiShm     *shm;
+    ScreenInfo  outputs[SCREEN_INFO_MAX_OUTPUTS];
+    size_t      num_outputs;
+    char        reply[SCREEN_INFO_MAX_OUTPUTS * 48];
+    size_t      reply_len;
+} DaemonState;
+
+// config changes are polled for on the heartbeat of the shared memory segment
+#define DAEMON_CONFIG_POLL_MS DPI_SHM_HEARTBEAT_MS
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void handle_stop(int sig)
+{
+    (void) sig;
+    daemon_stop = 1;
+}
+
+static bool config_changed(DaemonState *state)
+{
+    uint64_t stamp = config_set_stamp(state->config_path, state->config_dir);
+    bool changed = stamp != state->config_stamp;
+    state->config_stamp = stamp;
+    return changed;
+}
+
+static void publish(DaemonState *state, const uint16_t *dpis)
+{
+    static DpiShmOutput outputs[SCREEN_INFO_MAX_OUTPUTS];
+    memset(outputs, 0, sizeof(outputs));
+    for (size_t i = 0; i < state->num_outputs; ++i) {
+        const ScreenInfo *info = &state->outputs[i];
+        DpiShmOutput *output = &outputs[i];
+        memcpy(output->name, info->output_name, sizeof(output->name));
+        output->output = info->output;
+        output->dpi = dpis[i];
+        output->flags = info->output == info->stamp.primary_output ? DPI_SHM_PRIMARY : 0;
+        output->x = info->geometry.x;
+        output->y = info->geometry.y;
+        output->width = info->geometry.width;
+        output->height = info->geometry.height;
+        output->rotation = info->geometry.rotation;
+        output->edid = info->edid_info;
+    }
+    dpi_shm_publish(state->shm, outputs, state->num_outputs);
+}
+
+// the reply is rendered once per change, so serving a client is a single write
+static void render_reply(DaemonState *state)
+{
+    config_changed(state);
+    state->reply_len = 0;
+    uint16_t dpis[SCREEN_INFO_MAX_OUTPUTS];
+    dpi_suggest_all(state->config_path, state->config_dir, state->index_path, state->outputs, state->num_outputs, dpis);
+    for (size_t i = 0; i < state->num_outputs; ++i) {
+        const ScreenInfo *info = &state->outputs[i];
+        uint16_t dpi = dpis[i];
+        if (dpi == 0) continue;
+        int len = snprintf(state->reply + state->reply_len, sizeof(state->reply) - state->reply_len, "%s %u%s\n",
+                           info->output_name, dpi, info->output == info->stamp.primary_output ? " primary" : "");
+        if (len < 0 || (size_t) len >= sizeof(state->reply) - state->reply_len) break;
+        state->reply_len += len;
+        LOG(DEBUG, "daemon: output %s dpi=%u", info->output_name, dpi);
+    }
+    if (state->shm != NULL) {
+        publish(state, dpis);
+    }
+}
+
+static void refresh(DaemonState *state, struct xcb_connection_t *conn)
+{
+    state->num_outputs = screen_info_outputs(conn, state->outputs, SCREEN_INFO_MAX_OUTPUTS);
+    render_reply(state);
+}
+
+static int listen_unix(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        LOG(ERROR, "daemon: socket path is too long");
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG(ERROR, "daemon: failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        LOGB(ERROR, out) {
+            fputs("daemon: failed to listen on ", out);
+            fmt_quote_string(out, socket_path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool daemon_socket_path(char *restrict buf, size_t cap)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || *runtime_dir == '\0') return false;
+    int len = snprintf(buf, cap, "%s/suggestdpi.sock", runtime_dir);
+    return len > 0 && (size_t) len < cap;
+}
+
+bool daemon_run(const char *socket_path, const char *shm_name, const char *config_path, const char *config_dir,
+                const char *index_path)
+{
+    static DaemonState state;
+    memset(&state, 0, sizeof(state));
+    state.config_path = config_path;
+    state.config_dir = config_dir;
+    state.index_path = index_path;
+    state.shm_name = shm_name;
+
+    struct xcb_connection_t *conn = screen_info_connect();
+    if (conn == NULL) {
+        return false;
+    }
+    if (!screen_info_watch(conn)) {
+        screen_info_disconnect(conn);
+        return false;
+    }
+    int listen_fd = listen_unix(socket_path);
+    if (listen_fd < 0) {
+        screen_info_disconnect(conn);
+        return false;
+    }
+    if (shm_name != NULL) {
+        state.shm = dpi_shm_create(shm_name);
+        if (state.shm == NULL) {
+            LOG(ERROR, "daemon: failed to create shared memory segment %s: %s", shm_name, strerror(errno));
+            close(listen_fd);
+            unlink(socket_path);
+            screen_info_disconnect(conn);
+            return false;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    refresh(&state, conn);
+    LOGB(INFO, out) {
+        fputs("daemon: serving dpi on ", out);
+        fmt_quote_string(out, socket_path);
+    }
+
+    bool ok = true;
+    while (!daemon_stop) {
+        // events may already sit in the xcb queue, drain it before sleeping on the socket
+        int changed = screen_info_poll_changes(conn);
+        if (changed < 0) {
+            ok = false;
+            break;
+        }
+        if (changed > 0) {
+            LOG(DEBUG, "daemon: xrandr configuration changed");
+            refresh(&state, conn);
+        }
+
+        struct pollfd fds[2] = {
+            {screen_info_fd(conn), POLLIN, 0},
+            {listen_fd, POLLIN, 0},
+        };
+        // nobody connects to ask when readers use shared memory, so config changes are polled for
+        int timeout = state.shm != NULL ? DAEMON_CONFIG_POLL_MS : -1;
+        int ready = poll(fds, 2, timeout);
+        if (state.shm != NULL) dpi_shm_heartbeat(state.shm);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR, "daemon: poll failed: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+        if (ready == 0 && config_changed(&state)) {
+            LOG(DEBUG, "daemon: config file changed");
+            render_reply(&state);
+        }
+        if (fds[1].revents & POLLIN) {
+            int client = accept(listen_fd, NULL, NULL);
+            if (client < 0) continue;
+            if (config_changed(&state)) {
+                LOG(DEBUG, "daemon: config file changed");
+                render_reply(&state);
+            }
+            if (send(client, state.reply, state.reply_len, MSG_NOSIGNAL) < 0) {
+                LOG(DEBUG, "daemon: failed to reply: %s", strerror(errno));
+            }
+            close(client);
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    dpi_shm_destroy(state.shm, shm_name);
+    screen_info_disconnect(conn);
+    return ok;
+}
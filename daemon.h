@@ -0,0 +1,12 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool daemon_socket_path(char *restrict buf, size_t cap);
+// shm_name may be NULL, otherwise the outputs are also published in that shared memory segment
+bool daemon_run(const char *socket_path, const char *shm_name, const char *config_path, const char *config_dir,
+                const char *index_path);
+
+#endif // DAEMON_H
@@ -0,0 +1,379 @@
+#include "dpi.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "config_index.h"
+#include "config_set.h"
+#include "format.h"
+#include "log.h"
+#include "stats.h"
+
+// drop-in rules take the parse cache path, the index only ever covers the main config on its own
+static bool load_drop_ins(ConfigSet *set, const char *config_path, const char *config_dir)
+{
+    if (config_dir == NULL || !config_set_scan(set, config_path, config_dir)) return false;
+    if (set->num_drop_ins == 0 || !config_set_load(set)) {
+        config_set_free(set);
+        return false;
+    }
+    return true;
+}
+
+uint16_t dpi_from_config(const char *config_path, const char *config_dir, const char *index_path,
+                         const EdidInfo *edid)
+{
+    uint16_t dpi = 0;
+
+    ConfigSet set;
+    if (load_drop_ins(&set, config_path, config_dir)) {
+        for (size_t i = 0; i < set.num_sources; ++i) {
+            const ConfigSource *source = &set.sources[i];
+            for (size_t j = 0; j < source->num_rows; ++j) {
+                stats_config_row();
+                if (!config_row_match(&source->rows[j], edid)) continue;
+                dpi = source->rows[j].dpi;
+                LOG(DEBUG, "matched %s line %d, dpi=%u", source->path, source->rows[j].line, dpi);
+            }
+        }
+        config_set_free(&set);
+        return dpi;
+    }
+
+    ConfigIndex config_index;
+    if (config_index_open(&config_index, index_path, config_path)) {
+        stats_config_index(true);
+        config_index_lookup(&config_index, edid, &dpi);
+        config_index_close(&config_index);
+        return dpi;
+    }
+
+    ConfigFile config_file;
+    if (!config_open(&config_file, config_path)) {
+        LOGB(ERROR, out) {
+            fputs("failed to open config file ", out);
+            fmt_quote_string(out, config_path);
+        }
+        return dpi;
+    }
+    ConfigRow row;
+    while (read_config_row(&config_file, &row)) {
+        stats_config_row();
+        if (!config_row_match(&row, edid)) continue;
+        if (row.has_dpi) dpi = row.dpi;
+        LOG(DEBUG, "matched line %d, dpi=%u", row.line, dpi);
+    }
+    config_close(&config_file);
+    return dpi;
+}
+
+uint16_t dpi_from_size(unsigned screen_width, unsigned screen_height, unsigned physical_width, unsigned physical_height)
+{
+    static const double INCH_PER_CM = 0.3937008;
+    double fdpi = sqrt((pow(screen_width, 2) + pow(screen_height, 2))
+                           / (pow(physical_width * INCH_PER_CM, 2) + pow(physical_height * INCH_PER_CM, 2)));
+    LOG(DEBUG, "raw dpi: %g", fdpi);
+
+    return (uint16_t) ((fdpi + 12) / 24) * 24;
+}
+
+static bool dpi_from_info_size(const ScreenInfo *info, uint16_t *dpi)
+{
+    unsigned physical_width = info->edid_info.physical_width;
+    unsigned physical_height = info->edid_info.physical_height;
+    if (physical_width == 0 || physical_height == 0) {
+        LOG(INFO, "real monitor size is unknown");
+        return false;
+    }
+
+    unsigned screen_width = info->geometry.width;
+    unsigned screen_height = info->geometry.height;
+    if (screen_width == 0 || screen_height == 0) {
+        LOG(ERROR, "failed to get screen size");
+        return false;
+    }
+
+    *dpi = dpi_from_size(screen_width, screen_height, physical_width, physical_height);
+    return true;
+}
+
+bool dpi_suggest(const char *config_path, const char *config_dir, const char *index_path, const ScreenInfo *info,
+                 uint16_t *dpi)
+{
+    *dpi = dpi_from_config(config_path, config_dir, index_path, &info->edid_info);
+    if (*dpi != 0) {
+        return true;
+    }
+    return dpi_from_info_size(info, dpi);
+}
+
+static void init_matcher(ConfigMatcher *matcher, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    config_matcher_init(matcher);
+    for (size_t i = 0; i < num_infos; ++i) {
+        dpis[i] = 0;
+        config_matcher_add(matcher, &infos[i].edid_info);
+    }
+}
+
+static void apply_row(ConfigMatcher *matcher, const ConfigRow *row, const ScreenInfo *infos, uint16_t *dpis)
+{
+    stats_config_row();
+    if (!row->has_dpi) return;
+    for (ConfigOutputMask mask = config_matcher_match(matcher, row); mask != 0; mask &= mask - 1) {
+        size_t i = __builtin_ctzll(mask);
+        dpis[i] = row->dpi;
+        LOG(DEBUG, "output %s: matched line %d, dpi=%u", infos[i].output_name, row->line, row->dpi);
+    }
+}
+
+// one pass over the config for up to CONFIG_MATCH_MAX_OUTPUTS outputs, the last matching row wins per output
+static void dpi_from_config_batch(const char *config_path, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    static __thread ConfigMatcher matcher;
+    init_matcher(&matcher, infos, num_infos, dpis);
+
+    ConfigFile config_file;
+    if (!config_open(&config_file, config_path)) {
+        LOGB(ERROR, out) {
+            fputs("failed to open config file ", out);
+            fmt_quote_string(out, config_path);
+        }
+        return;
+    }
+    ConfigRow row;
+    while (read_config_row(&config_file, &row)) {
+        apply_row(&matcher, &row, infos, dpis);
+    }
+    config_close(&config_file);
+}
+
+static void dpi_from_rows_batch(const ConfigRow *rows, size_t num_rows, const ScreenInfo *infos, size_t num_infos,
+                                uint16_t *dpis)
+{
+    static __thread ConfigMatcher matcher;
+    init_matcher(&matcher, infos, num_infos, dpis);
+    for (size_t i = 0; i < num_rows; ++i) {
+        apply_row(&matcher, &rows[i], infos, dpis);
+    }
+}
+
+static void dpi_from_set_batch(const ConfigSet *set, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    static __thread ConfigMatcher matcher;
+    init_matcher(&matcher, infos, num_infos, dpis);
+    for (size_t i = 0; i < set->num_sources; ++i) {
+        for (size_t j = 0; j < set->sources[i].num_rows; ++j) {
+            apply_row(&matcher, &set->sources[i].rows[j], infos, dpis);
+        }
+    }
+}
+
+static size_t batch_size(size_t num_infos, size_t i)
+{
+    return num_infos - i < CONFIG_MATCH_MAX_OUTPUTS ? num_infos - i : CONFIG_MATCH_MAX_OUTPUTS;
+}
+
+static void dpi_from_set(const ConfigSet *set, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    for (size_t i = 0; i < num_infos; i += CONFIG_MATCH_MAX_OUTPUTS) {
+        dpi_from_set_batch(set, infos + i, batch_size(num_infos, i), dpis + i);
+    }
+}
+
+static void dpi_from_index(const ConfigIndex *config_index, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    stats_config_index(true);
+    for (size_t i = 0; i < num_infos; ++i) {
+        dpis[i] = 0;
+        config_index_lookup(config_index, &infos[i].edid_info, &dpis[i]);
+    }
+}
+
+// outputs the config has no dpi for fall back to their physical size
+static size_t dpi_from_sizes(const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < num_infos; ++i) {
+        if (dpis[i] != 0 || dpi_from_info_size(&infos[i], &dpis[i])) {
+            ++count;
+        } else {
+            dpis[i] = 0;
+        }
+    }
+    return count;
+}
+
+size_t dpi_suggest_all(const char *config_path, const char *config_dir, const char *index_path,
+                       const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    ConfigSet set;
+    ConfigIndex config_index;
+    if (load_drop_ins(&set, config_path, config_dir)) {
+        dpi_from_set(&set, infos, num_infos, dpis);
+        config_set_free(&set);
+    } else if (config_index_open(&config_index, index_path, config_path)) {
+        dpi_from_index(&config_index, infos, num_infos, dpis);
+        config_index_close(&config_index);
+    } else {
+        for (size_t i = 0; i < num_infos; i += CONFIG_MATCH_MAX_OUTPUTS) {
+            dpi_from_config_batch(config_path, infos + i, batch_size(num_infos, i), dpis + i);
+        }
+    }
+    return dpi_from_sizes(infos, num_infos, dpis);
+}
+
+// What the helper thread leaves behind: the drop-in set, the mapped index, or every row of
+// the main config parsed up front, since the streaming scan would put the parse back on the
+// caller's thread.
+typedef enum PrefetchKind {
+    PREFETCH_NONE,
+    PREFETCH_SET,
+    PREFETCH_INDEX,
+    PREFETCH_ROWS,
+} PrefetchKind;
+
+struct DpiConfigPrefetch {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    bool            done;
+    bool            abandoned;
+    LogContext     *log; // the caller's, the helper logs through it too
+    char           *config_path;
+    char           *config_dir;
+    char           *index_path;
+    PrefetchKind    kind;
+    ConfigSet       set;
+    ConfigIndex     config_index;
+    ConfigRow      *rows;
+    size_t          num_rows;
+};
+
+static bool prefetch_rows(DpiConfigPrefetch *prefetch)
+{
+    ConfigFile config_file;
+    if (!config_open(&config_file, prefetch->config_path)) {
+        LOGB(ERROR, out) {
+            fputs("failed to open config file ", out);
+            fmt_quote_string(out, prefetch->config_path);
+        }
+        return false;
+    }
+    size_t cap = 0;
+    ConfigRow row;
+    bool ok = true;
+    while (ok && read_config_row(&config_file, &row)) {
+        if (prefetch->num_rows == cap) {
+            cap = cap ? cap * 2 : 256;
+            ConfigRow *grown = realloc(prefetch->rows, cap * sizeof(ConfigRow));
+            if (grown == NULL) {
+                LOG(ERROR, "out of memory while parsing the config");
+                ok = false;
+                break;
+            }
+            prefetch->rows = grown;
+        }
+        prefetch->rows[prefetch->num_rows++] = row;
+    }
+    config_close(&config_file);
+    return ok;
+}
+
+static void prefetch_free(DpiConfigPrefetch *prefetch)
+{
+    if (prefetch->kind == PREFETCH_SET) config_set_free(&prefetch->set);
+    if (prefetch->kind == PREFETCH_INDEX) config_index_close(&prefetch->config_index);
+    free(prefetch->rows);
+    free(prefetch->config_path);
+    free(prefetch->config_dir);
+    free(prefetch->index_path);
+    pthread_mutex_destroy(&prefetch->lock);
+    free(prefetch);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    DpiConfigPrefetch *prefetch = arg;
+    log_use_context(prefetch->log);
+    if (load_drop_ins(&prefetch->set, prefetch->config_path, prefetch->config_dir)) {
+        prefetch->kind = PREFETCH_SET;
+    } else if (config_index_open(&prefetch->config_index, prefetch->index_path, prefetch->config_path)) {
+        prefetch->kind = PREFETCH_INDEX;
+    } else if (prefetch_rows(prefetch)) {
+        prefetch->kind = PREFETCH_ROWS;
+    }
+
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->done = true;
+    bool abandoned = prefetch->abandoned;
+    pthread_mutex_unlock(&prefetch->lock);
+    if (abandoned) prefetch_free(prefetch);
+    return NULL;
+}
+
+static char *copy_path(const char *path, bool *ok)
+{
+    if (path == NULL) return NULL;
+    char *copy = strdup(path);
+    *ok = *ok && copy != NULL;
+    return copy;
+}
+
+DpiConfigPrefetch *dpi_config_prefetch(const char *config_path, const char *config_dir, const char *index_path)
+{
+    DpiConfigPrefetch *prefetch = calloc(1, sizeof(DpiConfigPrefetch));
+    if (prefetch == NULL) return NULL;
+    pthread_mutex_init(&prefetch->lock, NULL);
+    prefetch->log = log_context;
+    // the helper may outlive the caller's strings when it is abandoned
+    bool ok = true;
+    prefetch->config_path = copy_path(config_path, &ok);
+    prefetch->config_dir = copy_path(config_dir, &ok);
+    prefetch->index_path = copy_path(index_path, &ok);
+    if (!ok || pthread_create(&prefetch->thread, NULL, prefetch_thread, prefetch) != 0) {
+        prefetch_free(prefetch);
+        return NULL;
+    }
+    return prefetch;
+}
+
+size_t dpi_config_finish(DpiConfigPrefetch *prefetch, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    pthread_join(prefetch->thread, NULL);
+    switch (prefetch->kind) {
+    case PREFETCH_SET:
+        dpi_from_set(&prefetch->set, infos, num_infos, dpis);
+        break;
+    case PREFETCH_INDEX:
+        dpi_from_index(&prefetch->config_index, infos, num_infos, dpis);
+        break;
+    case PREFETCH_ROWS:
+        for (size_t i = 0; i < num_infos; i += CONFIG_MATCH_MAX_OUTPUTS) {
+            dpi_from_rows_batch(prefetch->rows, prefetch->num_rows, infos + i, batch_size(num_infos, i), dpis + i);
+        }
+        break;
+    case PREFETCH_NONE:
+        memset(dpis, 0, num_infos * sizeof(uint16_t));
+        break;
+    }
+    prefetch_free(prefetch);
+    return dpi_from_sizes(infos, num_infos, dpis);
+}
+
+void dpi_config_abandon(DpiConfigPrefetch *prefetch)
+{
+    if (prefetch == NULL) return;
+    pthread_mutex_lock(&prefetch->lock);
+    bool done = prefetch->done;
+    prefetch->abandoned = true;
+    pthread_mutex_unlock(&prefetch->lock);
+    if (done) {
+        pthread_join(prefetch->thread, NULL);
+        prefetch_free(prefetch);
+    } else {
+        pthread_detach(prefetch->thread);
+    }
+}
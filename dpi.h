@@ -0,0 +1,43 @@
+#ifndef DPI_H
+#define DPI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "screen_info.h"
+
+#ifndef DEFAULT_CONFIG_PATH
+# define DEFAULT_CONFIG_PATH "/etc/suggestdpi.conf"
+#endif
+
+#ifndef DEFAULT_CONFIG_DIR
+# define DEFAULT_CONFIG_DIR "/etc/suggestdpi.d"
+#endif
+
+// what X servers assume when nothing better is known
+#define DPI_FALLBACK 96
+
+// config_dir may be NULL, otherwise its *.conf files are merged after config_path
+uint16_t dpi_from_config(const char *config_path, const char *config_dir, const char *index_path,
+                         const EdidInfo *edid);
+uint16_t dpi_from_size(unsigned screen_width, unsigned screen_height, unsigned physical_width, unsigned physical_height);
+bool dpi_suggest(const char *config_path, const char *config_dir, const char *index_path, const ScreenInfo *info,
+                 uint16_t *dpi);
+// fills dpis[i] for every output, 0 where no dpi can be suggested; returns how many got one
+size_t dpi_suggest_all(const char *config_path, const char *config_dir, const char *index_path,
+                       const ScreenInfo *infos, size_t num_infos, uint16_t *dpis);
+
+// Loads and parses the config on a helper thread, so a slow filesystem overlaps with the X
+// round trips of the probe instead of adding to them. dpi_config_finish joins the helper and
+// then works like dpi_suggest_all; dpi_config_abandon is for when the dpi is no longer needed
+// and leaves a helper that is still busy to clean up after itself, which must not outlive the
+// log context it was started under. NULL when no helper could be started, dpi_suggest_all
+// then has to do the work.
+typedef struct DpiConfigPrefetch DpiConfigPrefetch;
+
+DpiConfigPrefetch *dpi_config_prefetch(const char *config_path, const char *config_dir, const char *index_path);
+size_t dpi_config_finish(DpiConfigPrefetch *prefetch, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis);
+void dpi_config_abandon(DpiConfigPrefetch *prefetch);
+
+#endif // DPI_H
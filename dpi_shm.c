@@ -0,0 +1,163 @@
+#include "dpi_shm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// the reader library must not pull in the logger, errors are reported by return value only
+
+bool dpi_shm_default_name(char *restrict buf, size_t cap)
+{
+    // one segment per user, the daemon follows the display of the session it was started in
+    int len = snprintf(buf, cap, "/suggestdpi-%u", (unsigned) getuid());
+    return len > 0 && (size_t) len < cap;
+}
+
+const DpiShm *dpi_shm_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    // anyone can create names in /dev/shm, a segment of another user may carry forged values
+    if (fstat(fd, &st) == 0 && st.st_uid == getuid() && (size_t) st.st_size == sizeof(DpiShm)) {
+        map = mmap(NULL, sizeof(DpiShm), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const DpiShm *shm = map;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != DPI_SHM_MAGIC || shm->version != DPI_SHM_VERSION) {
+        munmap(map, sizeof(DpiShm));
+        return NULL;
+    }
+    return shm;
+}
+
+void dpi_shm_close(const DpiShm *shm)
+{
+    if (shm == NULL) return;
+    munmap((void *) shm, sizeof(DpiShm));
+}
+
+// a writer that died halfway leaves the sequence odd, readers give up instead of spinning forever
+#define DPI_SHM_READ_TRIES 4096
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static bool writer_alive(const DpiShm *shm)
+{
+    if (__atomic_load_n(&shm->live, __ATOMIC_RELAXED) == 0) return false;
+    uint64_t heartbeat = __atomic_load_n(&shm->heartbeat, __ATOMIC_RELAXED);
+    return monotonic_ns() - heartbeat < (uint64_t) DPI_SHM_STALE_MS * 1000000u;
+}
+
+static bool read_begin(const DpiShm *shm, uint32_t *sequence)
+{
+    *sequence = __atomic_load_n(&shm->sequence, __ATOMIC_ACQUIRE);
+    return (*sequence & 1u) == 0;
+}
+
+static bool read_valid(const DpiShm *shm, uint32_t sequence)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+bool dpi_shm_read(const DpiShm *restrict shm, DpiShmSnapshot *restrict snapshot)
+{
+    for (int i = 0; i < DPI_SHM_READ_TRIES; ++i) {
+        uint32_t sequence;
+        if (!read_begin(shm, &sequence)) continue;
+        snapshot->num_outputs = shm->num_outputs;
+        snapshot->primary = shm->primary;
+        if (snapshot->num_outputs > DPI_SHM_MAX_OUTPUTS) snapshot->num_outputs = DPI_SHM_MAX_OUTPUTS;
+        memcpy(snapshot->outputs, shm->outputs, snapshot->num_outputs * sizeof(DpiShmOutput));
+        if (read_valid(shm, sequence)) {
+            return writer_alive(shm);
+        }
+    }
+    return false;
+}
+
+uint16_t dpi_shm_primary_dpi(const DpiShm *shm)
+{
+    for (int i = 0; i < DPI_SHM_READ_TRIES; ++i) {
+        uint32_t sequence;
+        if (!read_begin(shm, &sequence)) continue;
+        uint32_t primary = shm->primary;
+        uint16_t dpi = primary < shm->num_outputs && primary < DPI_SHM_MAX_OUTPUTS ? shm->outputs[primary].dpi : 0;
+        if (read_valid(shm, sequence)) {
+            return writer_alive(shm) ? dpi : 0;
+        }
+    }
+    return 0;
+}
+
+DpiShm *dpi_shm_create(const char *name)
+{
+    // never reuse an existing segment, another user may have created it under our name
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(DpiShm)) == 0) {
+        map = mmap(NULL, sizeof(DpiShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // the segment starts zeroed, readers reject it until the magic is in place
+    DpiShm *shm = map;
+    shm->version = DPI_SHM_VERSION;
+    shm->num_outputs = 0;
+    shm->primary = 0;
+    dpi_shm_heartbeat(shm);
+    __atomic_store_n(&shm->live, 1u, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->magic, DPI_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+void dpi_shm_publish(DpiShm *restrict shm, const DpiShmOutput *restrict outputs, size_t num_outputs)
+{
+    if (num_outputs > DPI_SHM_MAX_OUTPUTS) num_outputs = DPI_SHM_MAX_OUTPUTS;
+    uint32_t sequence = __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    shm->num_outputs = (uint32_t) num_outputs;
+    shm->primary = (uint32_t) num_outputs;
+    for (size_t i = 0; i < num_outputs; ++i) {
+        if (outputs[i].flags & DPI_SHM_PRIMARY) shm->primary = (uint32_t) i;
+    }
+    memcpy(shm->outputs, outputs, num_outputs * sizeof(DpiShmOutput));
+
+    __atomic_store_n(&shm->sequence, sequence + 2, __ATOMIC_RELEASE);
+    dpi_shm_heartbeat(shm);
+}
+
+void dpi_shm_heartbeat(DpiShm *shm)
+{
+    __atomic_store_n(&shm->heartbeat, monotonic_ns(), __ATOMIC_RELAXED);
+}
+
+void dpi_shm_destroy(DpiShm *shm, const char *name)
+{
+    if (shm == NULL) return;
+    // readers that keep the old mapping see that nobody updates it anymore
+    __atomic_store_n(&shm->live, 0u, __ATOMIC_RELEASE);
+    munmap(shm, sizeof(DpiShm));
+    shm_unlink(name);
+}
@@ -0,0 +1,76 @@
+#ifndef DPI_SHM_H
+#define DPI_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edid.h"
+
+// Current dpi of every output, published by the daemon in a POSIX shared memory segment.
+// The segment is guarded by a seqlock: the writer makes the sequence odd while it updates
+// the outputs, readers copy what they need and retry if the sequence moved under them.
+// Readers never block the writer and need neither X nor libxcb, only this header and
+// dpi_shm.c (the suggestdpi_shm library).
+//
+// The daemon always creates a fresh segment and readers only trust segments owned by their own
+// user. A daemon that exits clears live; one that is killed cannot, so it also stamps a
+// CLOCK_MONOTONIC heartbeat into the segment at least every DPI_SHM_HEARTBEAT_MS, and readers
+// treat a heartbeat older than DPI_SHM_STALE_MS as a dead daemon. That keeps reads free of
+// system calls (the clock is read through the vDSO) and independent of pid namespaces and pid
+// reuse. The price: a daemon that is killed keeps being served for up to DPI_SHM_STALE_MS, a
+// daemon stuck that long on its X server counts as dead, and readers in another time
+// namespace than the daemon see a meaningless heartbeat.
+
+#define DPI_SHM_MAGIC 0x49504453u // "SDPI"
+#define DPI_SHM_VERSION 4u
+#define DPI_SHM_HEARTBEAT_MS 2000
+#define DPI_SHM_STALE_MS (5 * DPI_SHM_HEARTBEAT_MS)
+#define DPI_SHM_MAX_OUTPUTS 64
+#define DPI_SHM_PRIMARY 1u
+
+typedef struct DpiShmOutput {
+    char     name[32];
+    uint32_t output;
+    uint16_t dpi;      // 0 when no dpi could be suggested
+    uint16_t flags;    // DPI_SHM_PRIMARY
+    int16_t  x;
+    int16_t  y;
+    uint16_t width;
+    uint16_t height;
+    uint16_t rotation;
+    EdidInfo edid;
+} DpiShmOutput;
+
+typedef struct DpiShm {
+    uint32_t     magic;
+    uint32_t     version;
+    uint32_t     sequence; // odd while an update is in progress
+    uint32_t     live;      // cleared when the daemon exits
+    uint64_t     heartbeat; // CLOCK_MONOTONIC nanoseconds of the daemon's last beat
+    uint32_t     num_outputs;
+    uint32_t     primary;  // index into outputs, num_outputs when there is none
+    DpiShmOutput outputs[DPI_SHM_MAX_OUTPUTS];
+} DpiShm;
+
+typedef struct DpiShmSnapshot {
+    uint32_t     num_outputs;
+    uint32_t     primary;
+    DpiShmOutput outputs[DPI_SHM_MAX_OUTPUTS];
+} DpiShmSnapshot;
+
+bool dpi_shm_default_name(char *restrict buf, size_t cap);
+
+// reader side
+const DpiShm *dpi_shm_open(const char *name);
+void dpi_shm_close(const DpiShm *shm);
+bool dpi_shm_read(const DpiShm *restrict shm, DpiShmSnapshot *restrict snapshot);
+uint16_t dpi_shm_primary_dpi(const DpiShm *shm);
+
+// writer side
+DpiShm *dpi_shm_create(const char *name);
+void dpi_shm_publish(DpiShm *restrict shm, const DpiShmOutput *restrict outputs, size_t num_outputs);
+void dpi_shm_heartbeat(DpiShm *shm);
+void dpi_shm_destroy(DpiShm *shm, const char *name);
+
+#endif // DPI_SHM_H
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// Runs suggestdpi --drm against a fake sysfs tree built from the EDIDs in testdata/:
+//     card0             the device itself, not a connector
+//     card0-DP-1        connected, 3840x2160, edid_projector.bin (60x34 cm, no config row)
+//     card0-HDMI-A-1    disconnected
+//     card0-eDP-1       connected, 2560x1440, edid_widepanel.bin (replay.conf gives it 240)
+// DP-1 sorts first, so it stands in for the primary output.
+//
+// usage: suggestdpi_drm_test SUGGESTDPI TESTDATA
+
+typedef struct DrmFile {
+    const char *path;
+    const char *text;   // written as is, or NULL
+    const char *source; // copied from TESTDATA, or NULL
+} DrmFile;
+
+static const char *const DRM_DIRS[] = {"card0", "card0-DP-1", "card0-HDMI-A-1", "card0-eDP-1"};
+
+static const DrmFile DRM_FILES[] = {
+    {"card0-DP-1/status", "connected\n", NULL},
+    {"card0-DP-1/modes", "3840x2160\n1920x1080\n", NULL},
+    {"card0-DP-1/edid", NULL, "edid_projector.bin"},
+    {"card0-HDMI-A-1/status", "disconnected\n", NULL},
+    {"card0-HDMI-A-1/modes", "", NULL},
+    {"card0-HDMI-A-1/edid", "", NULL},
+    {"card0-eDP-1/status", "connected\n", NULL},
+    {"card0-eDP-1/modes", "2560x1440\n", NULL},
+    {"card0-eDP-1/edid", NULL, "edid_widepanel.bin"},
+};
+
+#define NUM_DRM_DIRS (sizeof(DRM_DIRS) / sizeof(DRM_DIRS[0]))
+#define NUM_DRM_FILES (sizeof(DRM_FILES) / sizeof(DRM_FILES[0]))
+
+typedef struct DrmCase {
+    const char *name;
+    const char *options[3]; // after --drm, -c and -R
+    const char *expected;
+} DrmCase;
+
+static const DrmCase CASES[] = {
+    {"primary", {NULL}, "168\n"},
+    {"all", {"--all", NULL}, "DP-1 168 primary\neDP-1 240\n"},
+    {"all/json", {"--all", "--format=json", NULL},
+     "{\"output\": \"DP-1\", \"dpi\": 168, \"primary\": true, \"pnp\": \"LGD\", \"product\": 4660, "
+     "\"name\": \"Projector\", \"serial\": \"SN42\", \"width_cm\": 60, \"height_cm\": 34}\n"
+     "{\"output\": \"eDP-1\", \"dpi\": 240, \"primary\": false, \"pnp\": \"LGD\", \"product\": 4660, "
+     "\"name\": \"WIDEPANEL34\", \"serial\": \"SN42\", \"width_cm\": 80, \"height_cm\": 34}\n"},
+};
+
+#define NUM_CASES (sizeof(CASES) / sizeof(CASES[0]))
+
+static bool write_file(const char *path, const void *data, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, data, len) == (ssize_t) len;
+    return (close(fd) == 0) && ok;
+}
+
+static bool copy_file(const char *dst, const char *src)
+{
+    char data[4096];
+    FILE *file = fopen(src, "rb");
+    if (file == NULL) return false;
+    size_t len = fread(data, 1, sizeof(data), file);
+    bool ok = ferror(file) == 0 && feof(file);
+    fclose(file);
+    return ok && write_file(dst, data, len);
+}
+
+static bool build_tree(const char *root, const char *testdata)
+{
+    char path[PATH_MAX], source[PATH_MAX];
+    for (size_t i = 0; i < NUM_DRM_DIRS; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, DRM_DIRS[i]);
+        if (mkdir(path, 0755) != 0) return false;
+    }
+    for (size_t i = 0; i < NUM_DRM_FILES; ++i) {
+        const DrmFile *file = &DRM_FILES[i];
+        snprintf(path, sizeof(path), "%s/%s", root, file->path);
+        snprintf(source, sizeof(source), "%s/%s", testdata, file->source ? file->source : "");
+        bool ok = file->source ? copy_file(path, source) : write_file(path, file->text, strlen(file->text));
+        if (!ok) {
+            LOG(ERROR, "failed to create %s: %s", path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void remove_tree(const char *root)
+{
+    char path[PATH_MAX];
+    for (size_t i = 0; i < NUM_DRM_FILES; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, DRM_FILES[i].path);
+        unlink(path);
+    }
+    for (size_t i = 0; i < NUM_DRM_DIRS; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", root, DRM_DIRS[i]);
+        rmdir(path);
+    }
+    rmdir(root);
+}
+
+// runs suggestdpi and collects its stdout, false when it did not exit with 0
+static bool run(char *const argv[], char *out, size_t cap)
+{
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    size_t len = 0;
+    for (;;) {
+        ssize_t got = read(fds[0], out + len, cap - 1 - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        len += got;
+    }
+    out[len] = '\0';
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool check_case(const char *suggestdpi, const char *testdata, const char *root, const DrmCase *test)
+{
+    char drm[PATH_MAX], config[PATH_MAX], config_dir[PATH_MAX];
+    snprintf(drm, sizeof(drm), "--drm=%s", root);
+    snprintf(config, sizeof(config), "--config=%s/replay.conf", testdata);
+    snprintf(config_dir, sizeof(config_dir), "--config-dir=%s/none", root);
+    char *argv[8] = {(char *) suggestdpi, drm, config, config_dir};
+    for (size_t i = 0; test->options[i] != NULL; ++i) {
+        argv[4 + i] = (char *) test->options[i];
+    }
+
+    char out[4096];
+    if (!run(argv, out, sizeof(out))) {
+        LOG(ERROR, "%s: suggestdpi failed", test->name);
+        return false;
+    }
+    if (strcmp(out, test->expected) != 0) {
+        LOG(ERROR, "%s: got\n%sexpected\n%s", test->name, out, test->expected);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s SUGGESTDPI TESTDATA\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *tmp_dir = getenv("TMPDIR");
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s/suggestdpi_drm.XXXXXX", tmp_dir && *tmp_dir ? tmp_dir : "/tmp");
+    if (mkdtemp(root) == NULL) {
+        LOG(ERROR, "failed to create %s: %s", root, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    log_set_level(LOG_LEVEL_ERROR);
+    bool built = build_tree(root, argv[2]);
+    bool ok = built;
+    for (size_t i = 0; built && i < NUM_CASES; ++i) {
+        bool passed = check_case(argv[1], argv[2], root, &CASES[i]);
+        fprintf(stderr, "%-24s %s\n", CASES[i].name, passed ? "ok" : "FAILED");
+        ok = passed && ok;
+    }
+    remove_tree(root);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,295 @@
+#include "edid.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "format.h"
+#include "log.h"
+
+static const int EDID_BLOCK_SIZE = 128;
+static const int EDID_EXTENSION_COUNT = 126;
+static const int EDID_DATA_BLOCKS = 54;
+static const uint8_t EDID_HEADER[8] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+
+static const uint8_t EDID_EXT_CTA = 0x02;
+static const uint8_t EDID_EXT_DISPLAYID = 0x70;
+
+// a plain copy of at most 13 bytes, the trimming is left to the readers below
+static void set_edid_string(EdidString *str, const uint8_t *ptr, size_t len)
+{
+    if (len > sizeof(str->raw)) len = sizeof(str->raw);
+    str->len = (uint8_t) len;
+    memcpy(str->raw, ptr, len);
+}
+
+// what counts of a descriptor string: up to the first line break, without surrounding blanks
+static size_t edid_string_span(const EdidString *str, const char **begin)
+{
+    size_t end = 0;
+    while (end < str->len && str->raw[end] != '\0' && str->raw[end] != '\r' && str->raw[end] != '\n') ++end;
+    size_t start = 0;
+    while (start < end && isspace((unsigned char) str->raw[start])) ++start;
+    while (end > start && isspace((unsigned char) str->raw[end - 1])) --end;
+    *begin = str->raw + start;
+    return end - start;
+}
+
+size_t edid_string_copy(const EdidString *str, char out[EDID_STRING_SIZE])
+{
+    const char *begin;
+    size_t len = edid_string_span(str, &begin);
+    memset(out, 0, EDID_STRING_SIZE);
+    memcpy(out, begin, len);
+    return len;
+}
+
+bool edid_string_equals(const EdidString *str, const char *value)
+{
+    const char *begin;
+    size_t len = edid_string_span(str, &begin);
+    return strncmp(value, begin, len) == 0 && value[len] == '\0';
+}
+
+void edid_string_quote(FILE *stream, const EdidString *str)
+{
+    char value[EDID_STRING_SIZE];
+    edid_string_copy(str, value);
+    fmt_quote_string(stream, value);
+}
+
+static void set_physical_size(EdidInfo *edid, unsigned width_mm, unsigned height_mm)
+{
+    unsigned width_cm = (width_mm + 5) / 10;
+    unsigned height_cm = (height_mm + 5) / 10;
+    edid->physical_width = (uint8_t) (width_cm > 255 ? 255 : width_cm);
+    edid->physical_height = (uint8_t) (height_cm > 255 ? 255 : height_cm);
+}
+
+// detailed timings carry the image size in mm, display descriptors start with a zero clock
+static bool read_timing_size(const uint8_t *dtd, EdidInfo *edid)
+{
+    if (dtd[0] == 0 && dtd[1] == 0) return false;
+    unsigned width_mm = dtd[12] | ((dtd[14] & 0xf0u) << 4u);
+    unsigned height_mm = dtd[13] | ((dtd[14] & 0x0fu) << 8u);
+    if (width_mm == 0 || height_mm == 0) return false;
+    set_physical_size(edid, width_mm, height_mm);
+    return true;
+}
+
+static void parse_cta_block(const uint8_t *block, EdidInfo *edid)
+{
+    // byte 2 is where the detailed timings start, they run up to the checksum byte
+    if (edid->physical_width != 0 || block[2] < 4) return;
+    for (int offset = block[2]; offset + 18 < EDID_BLOCK_SIZE; offset += 18) {
+        if (read_timing_size(block + offset, edid)) return;
+    }
+}
+
+static void parse_displayid_block(const uint8_t *block, EdidInfo *edid)
+{
+    // the section header holds the version, the payload length, the product type and the
+    // extension count; data blocks follow as tag, revision, length, payload
+    int end = 5 + block[2];
+    if (end > EDID_BLOCK_SIZE - 1) end = EDID_BLOCK_SIZE - 1;
+    for (int offset = 5; offset + 3 <= end;) {
+        uint8_t tag = block[offset];
+        uint8_t revision = block[offset + 1];
+        int len = block[offset + 2];
+        const uint8_t *payload = block + offset + 3;
+        if (offset + 3 + len > end) break;
+
+        switch (tag) {
+        case 0x00: // DISPLAYID_PRODUCT_ID
+        case 0x20: // DISPLAYID_2_PRODUCT_ID
+            // OUI, product code, serial, week and year come before the name
+            if (len > 12 && edid->product_name.len == 0) {
+                int name_len = payload[11] < len - 12 ? payload[11] : len - 12;
+                set_edid_string(&edid->product_name, payload + 12, (size_t) name_len);
+            }
+            break;
+        case 0x01: // DISPLAYID_DISPLAY_PARAMETERS
+        case 0x21: // DISPLAYID_2_DISPLAY_PARAMETERS
+            if (len >= 4 && edid->physical_width == 0) {
+                unsigned width = payload[0] | ((unsigned) payload[1] << 8u);
+                unsigned height = payload[2] | ((unsigned) payload[3] << 8u);
+                // tenths of a mm, whole mm when DisplayID 2 sets the size multiplier
+                if (tag == 0x21 && (revision & 0x80u)) {
+                    width *= 10;
+                    height *= 10;
+                }
+                if (width != 0 && height != 0) set_physical_size(edid, (width + 5) / 10, (height + 5) / 10);
+            }
+            break;
+        }
+        offset += 3 + len;
+    }
+}
+
+uint64_t hash_edid(Buffer buff)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < buff.len; ++i) {
+        hash ^= buff.ptr[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+bool parse_edid(Buffer buff, EdidInfo *edid)
+{
+    static const int EDID_PNP_ID_LO = 8;
+    static const int EDID_PNP_ID_HI = 9;
+    static const int EDID_PRODUCT = 10;
+    static const int EDID_SERIAL = 12;
+    static const int EDID_PHYSICAL_WIDTH = 21;
+    static const int EDID_PHYSICAL_HEIGHT = 22;
+
+    memset(edid, 0, sizeof(EdidInfo));
+
+    if (buff.len < 128) {
+        LOG(DEBUG, "edid length %lu insufficient", buff.len);
+        return false;
+    }
+    if (memcmp(EDID_HEADER, buff.ptr, sizeof(EDID_HEADER)) != 0) {
+        LOG(DEBUG, "edid header mismatch");
+        return false;
+    }
+
+    // PNP ID
+    edid->pnp_id[0] = (char) ('A' + ((buff.ptr[EDID_PNP_ID_LO] & 0x7cu) >> 2u) - 1);
+    edid->pnp_id[1] = (char) ('A' + ((buff.ptr[EDID_PNP_ID_LO] & 0x03u) << 3u) + ((buff.ptr[EDID_PNP_ID_HI] & 0xe0u) >> 5u) - 1);
+    edid->pnp_id[2] = (char) ('A' + (buff.ptr[EDID_PNP_ID_HI] & 0x1fu) - 1);
+    edid->pnp_id[3] = '\0';
+
+    // PRODUCT ID
+    edid->product_id = ((uint16_t) buff.ptr[EDID_PRODUCT])
+        + ((uint16_t) buff.ptr[EDID_PRODUCT + 1] << 8u);
+
+    // SERIAL
+    edid->serial_num = ((uint32_t) buff.ptr[EDID_SERIAL])
+        + ((uint32_t) buff.ptr[EDID_SERIAL + 1] << 8u)
+        + ((uint32_t) buff.ptr[EDID_SERIAL + 2] << 16u)
+        + ((uint32_t) buff.ptr[EDID_SERIAL + 3] << 24u);
+
+    // SCREEN SIZE
+    edid->physical_width = buff.ptr[EDID_PHYSICAL_WIDTH];
+    edid->physical_height = buff.ptr[EDID_PHYSICAL_HEIGHT];
+
+    for (int i = 0; i < 4; ++i) {
+        int offset = EDID_DATA_BLOCKS + i * 18;
+
+        if (buff.ptr[offset] != 0 || buff.ptr[offset + 1] != 0 || buff.ptr[offset + 2] != 0) {
+            continue;
+        }
+
+        // the raw bytes are copied as they are, edid_string_copy and edid_string_equals trim them on use
+        switch (buff.ptr[offset + 3]) {
+        case 0xfc: // EDID_DESC_PRODUCT_NAME
+            set_edid_string(&edid->product_name, buff.ptr + offset + 5, 13);
+            break;
+        case 0xfe: // EDID_DESC_ALPHANUMERIC_STRING
+            set_edid_string(&edid->identifier, buff.ptr + offset + 5, 13);
+            break;
+        case 0xff: // EDID_DESC_SERIAL_NUMBER
+            set_edid_string(&edid->serial_number, buff.ptr + offset + 5, 13);
+            break;
+        }
+    }
+
+    // projectors and some panels leave the size fields empty, the timings or the extension
+    // blocks may still know it; extensions are only walked for what the base block lacks
+    for (int i = 0; i < 4 && edid->physical_width == 0; ++i) {
+        if (read_timing_size(buff.ptr + EDID_DATA_BLOCKS + i * 18, edid)) break;
+    }
+    size_t num_blocks = 1 + (size_t) buff.ptr[EDID_EXTENSION_COUNT];
+    for (size_t i = 1; i < num_blocks && (i + 1) * EDID_BLOCK_SIZE <= buff.len; ++i) {
+        if (edid->physical_width != 0 && edid->product_name.len != 0) break;
+        const uint8_t *block = buff.ptr + i * EDID_BLOCK_SIZE;
+        if (block[0] == EDID_EXT_CTA) {
+            parse_cta_block(block, edid);
+        } else if (block[0] == EDID_EXT_DISPLAYID) {
+            parse_displayid_block(block, edid);
+        }
+    }
+
+    return true;
+}
+
+static uint8_t block_checksum(const uint8_t *block)
+{
+#if defined(__SSE2__)
+    // psadbw against zero sums each half of a 16 byte lane, eight loads cover the whole block
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    for (int i = 0; i < 128; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(bytes, zero));
+    }
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (uint8_t) _mm_cvtsi128_si32(sum);
+#else
+    uint8_t sum = 0;
+    for (int i = 0; i < 128; ++i) {
+        sum += block[i];
+    }
+    return sum;
+#endif
+}
+
+EdidValidity validate_edid(Buffer buff)
+{
+    if (buff.len < (size_t) EDID_BLOCK_SIZE) {
+        return EDID_TRUNCATED;
+    }
+    if (memcmp(EDID_HEADER, buff.ptr, sizeof(EDID_HEADER)) != 0) {
+        return EDID_BAD_HEADER;
+    }
+    size_t num_blocks = 1 + (size_t) buff.ptr[EDID_EXTENSION_COUNT];
+    if (buff.len < num_blocks * EDID_BLOCK_SIZE) {
+        return EDID_TRUNCATED;
+    }
+    for (size_t i = 0; i < num_blocks; ++i) {
+        if (block_checksum(buff.ptr + i * EDID_BLOCK_SIZE) != 0) {
+            return EDID_BAD_CHECKSUM;
+        }
+    }
+    return EDID_VALID;
+}
+
+const char *edid_validity_name(EdidValidity validity)
+{
+    switch (validity) {
+    case EDID_VALID:
+        return "ok";
+    case EDID_TRUNCATED:
+        return "truncated";
+    case EDID_BAD_HEADER:
+        return "bad_header";
+    case EDID_BAD_CHECKSUM:
+        return "bad_checksum";
+    default:
+        return "unknown";
+    }
+}
+
+bool read_edid_mode(Buffer buff, uint16_t *width, uint16_t *height)
+{
+    // the first detailed timing descriptor holds the preferred (native) mode
+    *width = 0;
+    *height = 0;
+    if (buff.len < (size_t) EDID_BLOCK_SIZE) {
+        return false;
+    }
+    const uint8_t *dtd = buff.ptr + EDID_DATA_BLOCKS;
+    if (dtd[0] == 0 && dtd[1] == 0) {
+        return false;
+    }
+    *width = (uint16_t) (dtd[2] | ((dtd[4] & 0xf0u) << 4u));
+    *height = (uint16_t) (dtd[5] | ((dtd[7] & 0xf0u) << 4u));
+    return *width != 0 && *height != 0;
+}
@@ -0,0 +1,34 @@
+#ifndef EDID_H
+#define EDID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "buffer.h"
+#include "suggestdpi_types.h"
+
+#define EDID_STRING_SIZE 16
+
+typedef enum EdidValidity {
+    EDID_VALID,
+    EDID_TRUNCATED,
+    EDID_BAD_HEADER,
+    EDID_BAD_CHECKSUM,
+} EdidValidity;
+
+bool parse_edid(Buffer buff, EdidInfo *edid);
+uint64_t hash_edid(Buffer buff);
+EdidValidity validate_edid(Buffer buff);
+const char *edid_validity_name(EdidValidity validity);
+bool read_edid_mode(Buffer buff, uint16_t *width, uint16_t *height);
+
+// the trimmed string, NUL terminated; returns its length
+size_t edid_string_copy(const EdidString *str, char out[EDID_STRING_SIZE]);
+// compares against the trimmed string in place, nothing is copied
+bool edid_string_equals(const EdidString *str, const char *value);
+// fmt_quote_string of the trimmed string
+void edid_string_quote(FILE *stream, const EdidString *str);
+
+#endif // EDID_H
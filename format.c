@@ -1,8 +1,14 @@
 #include "format.h"
 
 #include <stdint.h>
+#include <string.h>
 
-const char* char_quote_table[256] = {
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+// escapes are stored inline rather than as pointers, so the table needs no relocations in a PIE build
+static const char ESCAPE_TABLE[256][5] = {
     "\\x00", "\\x01", "\\x02", "\\x03", "\\x04", "\\x05", "\\x06", "\\x07", "\\x08", "\\t", "\\n", "\\x0b", "\\x0c",
     "\\r", "\\x0e", "\\x0f", "\\x10", "\\x11", "\\x12", "\\x13", "\\x14", "\\x15", "\\x16", "\\x17", "\\x18",
     "\\x19", "\\x1a", "\\x1b", "\\x1c", "\\x1d", "\\x1e", "\\x1f", " ", "!", "\\\"", "#", "$", "%", "&", "\\\'",
@@ -23,19 +29,94 @@ const char* char_quote_table[256] = {
     "\\xf7", "\\xf8", "\\xf9", "\\xfa", "\\xfb", "\\xfc", "\\xfd", "\\xfe", "\\xff"
 };
 
+// bytes that are copied verbatim; the single quote is only escaped outside of double quotes
+static bool is_safe(uint8_t ch, bool escape_single_quote)
+{
+    return ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\' && (ch != '\'' || !escape_single_quote);
+}
+
+static size_t safe_prefix(const uint8_t *src, size_t len, bool escape_single_quote)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    // bytes >= 0x80 are negative as signed chars, so one signed compare catches them with the controls
+    __m128i space = _mm_set1_epi8(0x20);
+    __m128i del = _mm_set1_epi8(0x7f);
+    __m128i dquote = _mm_set1_epi8('"');
+    __m128i squote = escape_single_quote ? _mm_set1_epi8('\'') : _mm_set1_epi8('"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i unsafe = _mm_or_si128(
+            _mm_or_si128(_mm_cmplt_epi8(bytes, space), _mm_cmpeq_epi8(bytes, del)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, dquote), _mm_cmpeq_epi8(bytes, squote)),
+                         _mm_cmpeq_epi8(bytes, backslash)));
+        int mask = _mm_movemask_epi8(unsafe);
+        if (mask != 0) {
+            return i + __builtin_ctz((unsigned) mask);
+        }
+    }
+#endif
+    while (i < len && is_safe(src[i], escape_single_quote)) ++i;
+    return i;
+}
+
+static char *escape_buffer(char *restrict dst, const char *restrict src, size_t len, bool escape_single_quote)
+{
+    const uint8_t *ptr = (const uint8_t *) src;
+    const uint8_t *end = ptr + len;
+    while (ptr != end) {
+        size_t run = safe_prefix(ptr, end - ptr, escape_single_quote);
+        memcpy(dst, ptr, run);
+        dst += run;
+        ptr += run;
+        if (ptr == end) break;
+        const char *escape = ESCAPE_TABLE[*ptr++];
+        size_t escape_len = strlen(escape);
+        memcpy(dst, escape, escape_len);
+        dst += escape_len;
+    }
+    return dst;
+}
+
 const char *fmt_escape_char(char ch)
 {
-    return char_quote_table[(uint8_t) ch];
+    return ESCAPE_TABLE[(uint8_t) ch];
 }
 
-void fmt_escape_string(FILE *stream, const char*str)
+char *fmt_escape_buffer(char *restrict dst, const char *restrict src, size_t len)
+{
+    return escape_buffer(dst, src, len, true);
+}
+
+char *fmt_quote_buffer(char *restrict dst, const char *restrict src, size_t len)
+{
+    *dst++ = '"';
+    dst = escape_buffer(dst, src, len, false);
+    *dst++ = '"';
+    return dst;
+}
+
+// the stream functions escape in chunks through a stack buffer, one fwrite per chunk
+#define FMT_CHUNK 256
+
+static void escape_stream(FILE *stream, const char *str, bool escape_single_quote)
+{
+    char buf[FMT_ESCAPED_MAX(FMT_CHUNK)];
+    size_t len = strlen(str);
+    for (size_t offset = 0; offset < len; offset += FMT_CHUNK) {
+        size_t chunk = len - offset < FMT_CHUNK ? len - offset : FMT_CHUNK;
+        char *end = escape_buffer(buf, str + offset, chunk, escape_single_quote);
+        fwrite(buf, 1, end - buf, stream);
+    }
+}
+
+void fmt_escape_string(FILE *stream, const char *str)
 {
     if (stream == NULL) return;
     if (str == NULL) return;
 
-    for (const char *p = str; *p != '\0'; ++p) {
-        fputs(char_quote_table[(uint8_t) *p], stream);
-    }
+    escape_stream(stream, str, true);
 }
 
 void fmt_quote_string(FILE *stream, const char *str)
@@ -46,13 +127,14 @@ void fmt_quote_string(FILE *stream, const char *str)
         return;
     }
 
-    fputc('"', stream);
-    for (const char *p = str; *p != '\0'; ++p) {
-        if (*p != '\'') {
-            fputs(char_quote_table[(uint8_t) *p], stream);
-        } else {
-            fputc('\'', stream);
-        }
+    size_t len = strlen(str);
+    if (len <= FMT_CHUNK) {
+        char buf[FMT_QUOTED_MAX(FMT_CHUNK)];
+        char *end = fmt_quote_buffer(buf, str, len);
+        fwrite(buf, 1, end - buf, stream);
+        return;
     }
     fputc('"', stream);
+    escape_stream(stream, str, false);
+    fputc('"', stream);
 }
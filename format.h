@@ -1,9 +1,21 @@
 #ifndef FORMAT_H
 #define FORMAT_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+// worst case output size of the buffer functions for len input bytes, every byte may become \xNN
+#define FMT_ESCAPED_MAX(len) ((len) * 4)
+#define FMT_QUOTED_MAX(len) (FMT_ESCAPED_MAX(len) + 2)
+
 const char *fmt_escape_char(char ch);
+
+// write the escaped (or double-quoted) form of len bytes of src to dst, which must have room
+// for FMT_ESCAPED_MAX(len) (or FMT_QUOTED_MAX(len)) bytes; returns the end of the output, not terminated
+char *fmt_escape_buffer(char *restrict dst, const char *restrict src, size_t len);
+char *fmt_quote_buffer(char *restrict dst, const char *restrict src, size_t len);
+
 void fmt_escape_string(FILE *stream, const char *str);
 void fmt_quote_string(FILE *stream, const char *str);
 
@@ -1,69 +1,113 @@
 #include "log.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
 
-static LogLevel log_level = LOG_LEVEL_INFO;
-static FILE *log_output = NULL;
+LogContext log_default_context = LOG_CONTEXT_INIT;
+__thread LogContext *log_context = &log_default_context;
+
+// LOGB records are assembled in a per-thread memory stream and leave in one piece
+static __thread char log_record_buf[LOG_RECORD_MAX];
+static __thread FILE *log_record = NULL;
+
+LogContext *log_use_context(LogContext *restrict context)
+{
+    LogContext *previous = log_context;
+    log_context = context ? context : &log_default_context;
+    return previous;
+}
 
 void log_set_level(LogLevel level)
 {
-    log_level = level;
+    log_context->level = level;
 }
 
 LogLevel log_get_level()
 {
-    return log_level;
+    return log_context->level;
 }
 
 void log_set_output(FILE *restrict output)
 {
-    log_output = output;
+    log_context->output = output;
 }
 
 FILE *log_get_output()
 {
-    return log_output ? log_output : stderr;
+    return log_context->output ? log_context->output : stderr;
+}
+
+static const char *log_level_prefix(LogLevel level)
+{
+    switch (level) {
+    case LOG_LEVEL_TRACE: return "trace: ";
+    case LOG_LEVEL_DEBUG: return "debug: ";
+    case LOG_LEVEL_INFO: return "info: ";
+    case LOG_LEVEL_WARN: return "warn: ";
+    case LOG_LEVEL_ERROR: return "error: ";
+    default: return "unknown: ";
+    }
+}
+
+static void log_write(char *record, size_t len)
+{
+    // callers leave room for the newline, a cut off record still ends its line
+    if (len == 0 || record[len - 1] != '\n') {
+        record[len++] = '\n';
+    }
+    FILE *stream = log_get_output();
+    int fd = fileno(stream);
+    if (fd < 0) {
+        fwrite(record, 1, len, stream);
+        return;
+    }
+    fflush(stream);
+    while (len > 0) {
+        ssize_t written = write(fd, record, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        record += written;
+        len -= written;
+    }
+}
+
+static size_t log_clamp(int len)
+{
+    if (len < 0) return 0;
+    return (size_t) len < LOG_RECORD_MAX ? (size_t) len : LOG_RECORD_MAX - 1;
 }
 
 void log_print(LogLevel level, const char *file, int line, const char *fmt, ...)
 {
-    FILE *stream = log_print_begin(level, file, line);
-    if (stream == NULL) return;
+    if (level < log_context->level) return;
+
+    char record[LOG_RECORD_MAX];
+    size_t len = log_clamp(snprintf(record, sizeof(record), "%s(%s:%d) ", log_level_prefix(level), file, line));
 
     va_list args;
     va_start(args, fmt);
-    vfprintf(stream, fmt, args);
+    len += log_clamp(vsnprintf(record + len, sizeof(record) - len, fmt, args));
     va_end(args);
+    if (len > sizeof(record) - 1) len = sizeof(record) - 1;
 
-    fputc('\n', stream);
+    log_write(record, len);
 }
 
 FILE *log_print_begin(LogLevel level, const char *file, int line)
 {
-    FILE *stream = log_output ? log_output : stderr;
-    if (level < log_level) return NULL;
-
-    switch (level) {
-    case LOG_LEVEL_TRACE: fprintf(stream, "trace: "); break;
-    case LOG_LEVEL_DEBUG: fprintf(stream, "debug: "); break;
-    case LOG_LEVEL_INFO: fprintf(stream, "info: "); break;
-    case LOG_LEVEL_WARN: fprintf(stream, "warn: "); break;
-    case LOG_LEVEL_ERROR: fprintf(stream, "error: "); break;
-    default: fprintf(stream, "LogLevel(%d): ", level);
-    }
+    if (level < log_context->level) return NULL;
 
-    for (const char *ch = file + strlen(file) - 1; ch >= file; --ch) {
-        if (*ch == '/') {
-            file = ch + 1;
-            break;
-        }
+    if (log_record == NULL) {
+        log_record = fmemopen(log_record_buf, sizeof(log_record_buf) - 1, "w");
+        if (log_record == NULL) return NULL;
+        setvbuf(log_record, NULL, _IONBF, 0);
     }
-
-    fprintf(stream, "(%s:%d) ", file, line);
-
-    return stream;
+    rewind(log_record);
+    fprintf(log_record, "%s(%s:%d) ", log_level_prefix(level), file, line);
+    return log_record;
 }
 
 FILE *log_print_begin_msg(LogLevel level, const char *file, int line, const char *msg)
@@ -73,3 +117,10 @@ FILE *log_print_begin_msg(LogLevel level, const char *file, int line, const char
     fputs(msg, stream);
     return stream;
 }
+
+void log_print_end(FILE *record)
+{
+    long len = ftell(record);
+    if (len < 0) return;
+    log_write(log_record_buf, (size_t) len < sizeof(log_record_buf) - 1 ? (size_t) len : sizeof(log_record_buf) - 1);
+}
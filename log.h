@@ -3,25 +3,47 @@
 
 #include <stdio.h>
 
-typedef enum LogLevel {
-    LOG_LEVEL_TRACE,
-    LOG_LEVEL_DEBUG,
-    LOG_LEVEL_INFO,
-    LOG_LEVEL_WARN,
-    LOG_LEVEL_ERROR,
-} LogLevel;
+#include "suggestdpi_types.h"
 
+// records below LOG_MIN_LEVEL are compiled out, arguments included
+#ifndef LOG_MIN_LEVEL
+# define LOG_MIN_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// the basename of the source file, without looking at the path at run time
+#ifdef __FILE_NAME__
+# define LOG_FILE __FILE_NAME__
+#else
+# define LOG_FILE __FILE__
+#endif
+
+// the longest record, anything past it is cut off
+#define LOG_RECORD_MAX 4096
+
+#define LOG_CONTEXT_INIT {LOG_LEVEL_INFO, NULL}
+
+extern LogContext log_default_context;
+extern __thread LogContext *log_context;
+
+// makes context current for the calling thread and returns the previous one
+LogContext *log_use_context(LogContext *restrict context);
+
+// these act on the current context
 void log_set_level(LogLevel level);
 LogLevel log_get_level();
 void log_set_output(FILE *restrict output);
 FILE *log_get_output();
 
-void log_print(LogLevel level, const char *file, int line, const char *fmt, ...);
+void log_print(LogLevel level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
 FILE *log_print_begin(LogLevel level, const char *file, int line);
 FILE *log_print_begin_msg(LogLevel level, const char *file, int line, const char *msg);
+void log_print_end(FILE *record);
+
+#define LOG_ENABLED(L) (LOG_LEVEL_##L >= LOG_MIN_LEVEL && LOG_LEVEL_##L >= log_context->level)
 
-#define LOG(L, FMT, ...) log_print(LOG_LEVEL_##L, __FILE__, __LINE__, FMT, ##__VA_ARGS__)
-#define LOGB(L, out) for (FILE *out = log_print_begin(LOG_LEVEL_##L, __FILE__, __LINE__); (out) != NULL; fputc('\n', (out)), (out) = NULL)
-#define LOGBM(L, out, msg) for (FILE *out = log_print_begin_msg(LOG_LEVEL_##L, __FILE__, __LINE__, msg); (out) != NULL; fputc('\n', (out)), (out) = NULL)
+#define LOG(L, FMT, ...) do { if (LOG_ENABLED(L)) log_print(LOG_LEVEL_##L, LOG_FILE, __LINE__, FMT, ##__VA_ARGS__); } while (0)
+#define LOGB(L, out) for (FILE *out = LOG_ENABLED(L) ? log_print_begin(LOG_LEVEL_##L, LOG_FILE, __LINE__) : NULL; (out) != NULL; log_print_end(out), (out) = NULL)
+#define LOGBM(L, out, msg) for (FILE *out = LOG_ENABLED(L) ? log_print_begin_msg(LOG_LEVEL_##L, LOG_FILE, __LINE__, msg) : NULL; (out) != NULL; log_print_end(out), (out) = NULL)
 
 #endif // LOG_H
@@ -1,28 +1,67 @@
 #include <stdlib.h>
 #include <getopt.h>
-#include <math.h>
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "config.h"
+#include "batch.h"
+#include "cache.h"
+#include "config_index.h"
+#include "config_set.h"
+#include "corpus.h"
+#include "daemon.h"
+#include "dpi.h"
+#include "dpi_shm.h"
 #include "log.h"
 #include "format.h"
+#include "report.h"
 #include "screen_info.h"
-
-#ifndef DEFAULT_CONFIG_PATH
-# define DEFAULT_CONFIG_PATH "/etc/suggestdpi.conf"
-#endif
+#include "screen_info_drm.h"
+#include "screen_info_replay.h"
+#include "stats.h"
+#include "xresources.h"
 
 struct option long_options[] = {
     {"help", no_argument, NULL, 'h'},
     {"verbose", no_argument, NULL, 'v'},
     {"config", optional_argument, NULL, 'c'},
+    {"config-dir", required_argument, NULL, 'R'},
+    {"compile", no_argument, NULL, 'C'},
+    {"no-cache", no_argument, NULL, 'n'},
+    {"daemon", optional_argument, NULL, 'd'},
+    {"shm", optional_argument, NULL, 'm'},
+    {"all", no_argument, NULL, 'a'},
+    {"analyze", no_argument, NULL, 'A'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"drm", optional_argument, NULL, 'D'},
+    {"stats", no_argument, NULL, 's'},
+    {"displays", required_argument, NULL, 'M'},
+    {"timeout", required_argument, NULL, 't'},
+    {"format", required_argument, NULL, 'f'},
+    {"xrdb", no_argument, NULL, 'x'},
+    {"record", required_argument, NULL, 'r'},
+    {"replay", required_argument, NULL, 'p'},
+    {"latency", required_argument, NULL, 'l'},
     {0, 0, 0, 0},
 };
 
+static void print_stats(void)
+{
+    stats_print(stderr);
+}
+
+static void stop_recording(void)
+{
+    screen_info_record_stop();
+}
+
 void print_usage(const char *exe)
 {
     static const char *usage =
-        "usage: %s [-hv] [-c CONFIG]\n"
+        "usage: %s [-hvCnasx] [-c CONFIG] [-R DIR] [-d[SOCKET]] [-m[NAME]] [-D[SYSROOT]] [-M DISPLAYS] [-t MS] [-f FORMATS]\n"
+        "          [-r FILE | -p FILE [-l US]]\n"
+        "       %s -A [-j JOBS] [-c CONFIG] PATH...\n"
         "\n"
         "options:\n"
         "    -h, --help\n"
@@ -30,15 +69,214 @@ void print_usage(const char *exe)
         "    -v, --verbose\n"
         "           increase verbosity\n"
         "    -c, --config=CONFIG\n"
-        "           load dpi config from CONFIG instead of " DEFAULT_CONFIG_PATH "\n";
-    fprintf(stderr, usage, exe);
+        "           load dpi config from CONFIG instead of " DEFAULT_CONFIG_PATH "\n"
+        "    -R, --config-dir=DIR\n"
+        "           merge the *" CONFIG_SET_SUFFIX " files of DIR after CONFIG, in byte order of their names\n"
+        "           (default: " DEFAULT_CONFIG_DIR ", pass an empty DIR to disable)\n"
+        "    -C, --compile\n"
+        "           compile CONFIG into CONFIG" CONFIG_INDEX_SUFFIX " for faster lookups and exit\n"
+        "    -n, --no-cache\n"
+        "           always probe the display instead of reusing the result cached in $XDG_RUNTIME_DIR\n"
+        "    -d, --daemon[=SOCKET]\n"
+        "           keep running, follow xrandr changes and serve the dpi of every output on the unix\n"
+        "           socket SOCKET (default: $XDG_RUNTIME_DIR/suggestdpi.sock)\n"
+        "    -m, --shm[=NAME]\n"
+        "           with --daemon, also publish every output in the POSIX shared memory segment NAME\n"
+        "           (default: /suggestdpi-$UID); without it, answer from that segment when a daemon is live\n"
+        "    -a, --all\n"
+        "           print the dpi of every connected output instead of the primary one\n"
+        "    -D, --drm[=SYSROOT]\n"
+        "           read the outputs from the kernel's drm connectors in SYSROOT\n"
+        "           (default: " SCREEN_INFO_DRM_ROOT ") instead of the X server\n"
+        "    -s, --stats\n"
+        "           print phase timings, X request counts and config rows scanned as one JSON object\n"
+        "           to stderr on exit\n"
+        "    -M, --displays=DISPLAYS\n"
+        "           probe every X display in the comma separated list DISPLAYS (- reads it from stdin)\n"
+        "           concurrently and print \"DISPLAY DPI\" lines as they finish; with --all one\n"
+        "           \"DISPLAY OUTPUT DPI\" line per output\n"
+        "    -t, --timeout=MS\n"
+        "           give up on the X server after MS milliseconds and print the last cached dpi of\n"
+        "           the display instead, or the dpi of the core screen size, or %d; with --displays,\n"
+        "           give up on the displays that are not done after MS milliseconds (default: 10000)\n"
+        "    -f, --format=FORMATS\n"
+        "           print the result in each of the comma separated FORMATS, in that order: plain (the\n"
+        "           default), xft (an Xft.dpi resource line), env (GDK and Qt scaling exports) and json\n"
+        "           (one object per output)\n"
+        "    -x, --xrdb\n"
+        "           also set Xft.dpi to the dpi of the primary output in the RESOURCE_MANAGER property\n"
+        "           of the display, like xrdb -merge but on the connection that probed it\n"
+        "    -r, --record=FILE\n"
+        "           save the connection setup and every X reply the probe receives to FILE\n"
+        "    -p, --replay=FILE\n"
+        "           probe a display recorded with --record instead of the X server; the other options\n"
+        "           must be the ones of the recording\n"
+        "    -l, --latency=US\n"
+        "           with --replay, delay every round trip by US microseconds\n"
+        "    -A, --analyze\n"
+        "           analyze the raw EDID blobs in PATH (files, directories or .tar archives) offline\n"
+        "           instead of probing the display\n"
+        "    -j, --jobs=JOBS\n"
+        "           number of worker threads for --analyze (default: number of online cpus)\n";
+    fprintf(stderr, usage, exe, exe, DPI_FALLBACK);
+}
+
+static bool report_infos(const ReportFormats *formats, bool all_outputs, const ScreenInfo *infos,
+                         const uint16_t *dpis, size_t num_infos)
+{
+    ReportOutput outputs[SCREEN_INFO_MAX_OUTPUTS];
+    size_t num_outputs = 0;
+    for (size_t i = 0; i < num_infos && num_outputs < SCREEN_INFO_MAX_OUTPUTS; ++i) {
+        if (dpis[i] == 0) continue;
+        ReportOutput *output = &outputs[num_outputs++];
+        output->name = infos[i].output_name;
+        output->dpi = dpis[i];
+        output->primary = !all_outputs || infos[i].output == infos[i].stamp.primary_output;
+        output->edid = &infos[i].edid_info;
+    }
+    return report_write(STDOUT_FILENO, formats, outputs, num_outputs, all_outputs);
+}
+
+// Xft.dpi follows the primary output, or the first one with a dpi when none is primary
+static bool update_xrdb(struct xcb_connection_t *conn, const ScreenInfo *infos, const uint16_t *dpis,
+                        size_t num_infos, uint64_t deadline)
+{
+    uint16_t dpi = 0;
+    for (size_t i = 0; i < num_infos; ++i) {
+        if (dpis[i] == 0) continue;
+        if (dpi == 0 || infos[i].output == infos[i].stamp.primary_output) dpi = dpis[i];
+        if (infos[i].output == infos[i].stamp.primary_output) break;
+    }
+    return dpi != 0 && xresources_set_dpi(conn, dpi, deadline);
+}
+
+// joins the config helper, or does its work here when none could be started
+static size_t suggest_dpis(DpiConfigPrefetch *prefetch, const char *config_path, const char *config_dir,
+                           const char *index_path, const ScreenInfo *infos, size_t num_infos, uint16_t *dpis)
+{
+    if (prefetch != NULL) {
+        return dpi_config_finish(prefetch, infos, num_infos, dpis);
+    }
+    return dpi_suggest_all(config_path, config_dir, index_path, infos, num_infos, dpis);
+}
+
+static uint16_t fallback_dpi(struct xcb_connection_t *conn, const char *display, const char *config_path,
+                             const char *config_dir)
+{
+    uint16_t dpi;
+    if (cache_load_stale(display, config_path, config_dir, &dpi)) {
+        LOG(WARN, "deadline passed, using the last known dpi");
+        return dpi;
+    }
+    OutputGeometry geometry;
+    unsigned width_mm, height_mm;
+    if (conn != NULL && screen_info_core_size(conn, &geometry, &width_mm, &height_mm) && width_mm >= 10
+        && height_mm >= 10) {
+        LOG(WARN, "deadline passed, using the size of the core screen");
+        return dpi_from_size(geometry.width, geometry.height, (width_mm + 5) / 10, (height_mm + 5) / 10);
+    }
+    LOG(WARN, "deadline passed, using the default dpi");
+    return DPI_FALLBACK;
+}
+
+// the non-blocking probe with one deadline for connecting and probing; a primary dpi is
+// always printed once the deadline passed, --all has nothing to fall back on and fails
+static int probe_until(uint64_t deadline, const ReportFormats *formats, bool use_cache, bool all_outputs,
+                       bool set_xrdb, const char *config_path, const char *config_dir, const char *index_path)
+{
+    const char *display = use_cache ? getenv("DISPLAY") : NULL;
+    ScreenInfo cached_info;
+    uint16_t cached_dpi;
+    stats_phase_begin(STATS_PHASE_CACHE);
+    bool cached = display != NULL && !all_outputs
+        && cache_load(display, config_path, config_dir, &cached_info, &cached_dpi);
+    stats_phase_end(STATS_PHASE_CACHE);
+    // as in the blocking path, the config is only needed once the cache turned out to be stale
+    DpiConfigPrefetch *prefetch = cached ? NULL : dpi_config_prefetch(config_path, config_dir, index_path);
+    stats_phase_begin(STATS_PHASE_CONNECT);
+    struct xcb_connection_t *conn = screen_info_connect_until(deadline);
+    stats_phase_end(STATS_PHASE_CONNECT);
+    ScreenInfoProbe *probe = conn ? screen_info_probe_start(conn, all_outputs) : NULL;
+    ScreenInfoProbeState state = SCREEN_INFO_PROBE_FAILED;
+    if (probe != NULL && cached) screen_info_probe_check(probe, &cached_info);
+
+    ScreenStamp stamp;
+    uint64_t edid_hash;
+    stats_phase_begin(STATS_PHASE_STAMP);
+    bool stamped = cached && probe != NULL && screen_info_probe_wait_stamp(probe, deadline, &stamp, &edid_hash);
+    stats_phase_end(STATS_PHASE_STAMP);
+    if (stamped) {
+        if (cache_valid(&cached_info, &stamp, edid_hash)) {
+            // the output requests already sent are dropped with the connection
+            bool ok = report_infos(formats, false, &cached_info, &cached_dpi, 1);
+            ok = (!set_xrdb || xresources_set_dpi(conn, cached_dpi, deadline)) && ok;
+            screen_info_probe_free(probe);
+            screen_info_disconnect(conn);
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        prefetch = dpi_config_prefetch(config_path, config_dir, index_path);
+    }
+
+    if (probe != NULL) {
+        stats_phase_begin(STATS_PHASE_PROBE);
+        state = screen_info_probe_wait(probe, deadline);
+        stats_phase_end(STATS_PHASE_PROBE);
+    }
+
+    int status = EXIT_FAILURE;
+    if (state == SCREEN_INFO_PROBE_DONE) {
+        const ScreenInfo *infos;
+        size_t num_infos = screen_info_probe_result(probe, &infos);
+        uint16_t dpis[SCREEN_INFO_MAX_OUTPUTS];
+        stats_phase_begin(STATS_PHASE_DPI);
+        size_t num_dpis = suggest_dpis(prefetch, config_path, config_dir, index_path, infos, num_infos, dpis);
+        prefetch = NULL;
+        stats_phase_end(STATS_PHASE_DPI);
+        if (!all_outputs && num_dpis > 0) {
+            cache_store(display, config_path, config_dir, &infos[0], dpis[0]);
+        }
+        bool ok = report_infos(formats, all_outputs, infos, dpis, num_infos);
+        ok = (!set_xrdb || update_xrdb(conn, infos, dpis, num_infos, deadline)) && ok;
+        status = ok && num_dpis > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (screen_info_deadline_after(0) >= deadline) {
+        if (all_outputs) {
+            LOG(ERROR, "deadline passed before the outputs were probed");
+        } else {
+            ReportOutput output = {NULL, fallback_dpi(conn, display, config_path, config_dir), true, NULL};
+            status = report_write(STDOUT_FILENO, formats, &output, 1, false) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    // past the deadline the helper may still be stuck on the filesystem, it is not waited for
+    dpi_config_abandon(prefetch);
+    screen_info_probe_free(probe);
+    screen_info_disconnect(conn);
+    return status;
 }
 
 int main(int argc, char *argv[])
 {
+    stats_init();
     int option_idx = 0, option_chr;
     const char *config_path = DEFAULT_CONFIG_PATH;
-    while ((option_chr = getopt_long(argc, argv, "hvc:", long_options, &option_idx)) != -1) {
+    const char *config_dir = DEFAULT_CONFIG_DIR;
+    bool compile = false;
+    bool use_cache = true;
+    bool daemon = false;
+    const char *socket_path = NULL;
+    bool use_shm = false;
+    const char *shm_name = NULL;
+    bool all_outputs = false;
+    bool analyze = false;
+    long jobs = 0;
+    const char *drm_root = NULL;
+    const char *display_list = NULL;
+    long timeout_ms = 0;
+    ReportFormats formats = {{REPORT_PLAIN}, 1};
+    bool set_xrdb = false;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    long latency_us = 0;
+    while ((option_chr = getopt_long(argc, argv, "hvc:R:Cnd::m::aAj:D::sM:t:f:xr:p:l:", long_options, &option_idx)) != -1) {
         switch (option_chr) {
         case 'h':
             print_usage(argv[0]);
@@ -49,65 +287,272 @@ int main(int argc, char *argv[])
         case 'c':
             config_path = optarg;
             break;
+        case 'R':
+            config_dir = *optarg != '\0' ? optarg : NULL;
+            break;
+        case 'C':
+            compile = true;
+            break;
+        case 'n':
+            use_cache = false;
+            break;
+        case 'd':
+            daemon = true;
+            socket_path = optarg;
+            break;
+        case 'm':
+            use_shm = true;
+            shm_name = optarg;
+            break;
+        case 'a':
+            all_outputs = true;
+            break;
+        case 'A':
+            analyze = true;
+            break;
+        case 'j':
+            jobs = strtol(optarg, NULL, 10);
+            if (jobs <= 0) {
+                LOG(ERROR, "invalid number of jobs: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'D':
+            drm_root = optarg ? optarg : SCREEN_INFO_DRM_ROOT;
+            break;
+        case 's':
+            atexit(print_stats);
+            break;
+        case 'M':
+            display_list = optarg;
+            break;
+        case 'x':
+            set_xrdb = true;
+            break;
+        case 'f':
+            if (!report_parse_formats(optarg, &formats)) return EXIT_FAILURE;
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'p':
+            replay_path = optarg;
+            break;
+        case 'l':
+            latency_us = strtol(optarg, NULL, 10);
+            if (latency_us < 0 || latency_us > INT32_MAX) {
+                LOG(ERROR, "invalid latency: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            timeout_ms = strtol(optarg, NULL, 10);
+            if (timeout_ms <= 0 || timeout_ms > INT32_MAX) {
+                LOG(ERROR, "invalid timeout: %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         default:
             print_usage(argv[0]);
             return EXIT_FAILURE;
         }
     }
 
-    ScreenInfo primary_screen_info;
-    if (!screen_info_primary(&primary_screen_info)) {
+    char index_path[PATH_MAX];
+    if (!config_index_path(index_path, sizeof(index_path), config_path)) {
+        LOG(ERROR, "config path is too long");
         return EXIT_FAILURE;
     }
 
-    uint16_t dpi = 0;
+    if (compile) {
+        return config_index_compile(config_path, index_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (analyze) {
+        if (optind == argc) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (jobs == 0) {
+            jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        bool ok = corpus_analyze(argv + optind, argc - optind, config_path, index_path, jobs > 0 ? (unsigned) jobs : 1);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // recordings cover one probe of one X display, the cache would skip it
+    if (record_path != NULL || replay_path != NULL) {
+        if (daemon || use_shm || display_list != NULL || drm_root != NULL || (replay_path != NULL && set_xrdb)) {
+            LOG(ERROR, "--record and --replay need a single X display to probe");
+            return EXIT_FAILURE;
+        }
+        use_cache = false;
+    }
+    if (record_path != NULL) {
+        if (!screen_info_record_start(record_path)) return EXIT_FAILURE;
+        atexit(stop_recording);
+    }
+    if (replay_path != NULL && !screen_info_replay_start(replay_path, (unsigned) latency_us)) {
+        return EXIT_FAILURE;
+    }
+
+    char default_shm_name[64];
+    if (use_shm && shm_name == NULL) {
+        dpi_shm_default_name(default_shm_name, sizeof(default_shm_name));
+        shm_name = default_shm_name;
+    }
+
+    // the shared memory shortcut has no connection to write the resource on
+    if (use_shm && !daemon && !set_xrdb) {
+        const DpiShm *shm = dpi_shm_open(shm_name);
+        static DpiShmSnapshot snapshot;
+        bool live = shm != NULL && dpi_shm_read(shm, &snapshot);
+        dpi_shm_close(shm);
+        if (live && (all_outputs || snapshot.primary < snapshot.num_outputs)) {
+            ReportOutput outputs[DPI_SHM_MAX_OUTPUTS];
+            size_t num_outputs = 0;
+            for (uint32_t i = 0; i < snapshot.num_outputs; ++i) {
+                const DpiShmOutput *output = &snapshot.outputs[i];
+                if (output->dpi == 0 || (!all_outputs && i != snapshot.primary)) continue;
+                outputs[num_outputs].name = output->name;
+                outputs[num_outputs].dpi = output->dpi;
+                outputs[num_outputs].primary = (output->flags & DPI_SHM_PRIMARY) != 0;
+                outputs[num_outputs].edid = &output->edid;
+                ++num_outputs;
+            }
+            bool ok = report_write(STDOUT_FILENO, &formats, outputs, num_outputs, all_outputs);
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        LOG(DEBUG, "shm: no live daemon, probing the display");
+    }
 
-    FILE *config_file = fopen(config_path, "r");
-    if (config_file == NULL) {
-        LOGB(ERROR, out) {
-            fputs("failed to open config file ", out);
-            fmt_quote_string(out, config_path);
+    if (daemon) {
+        char default_socket_path[PATH_MAX];
+        if (socket_path == NULL) {
+            if (!daemon_socket_path(default_socket_path, sizeof(default_socket_path))) {
+                LOG(ERROR, "XDG_RUNTIME_DIR is not set, pass the socket path explicitly");
+                return EXIT_FAILURE;
+            }
+            socket_path = default_socket_path;
         }
-    } else {
-        ConfigRow row;
-        const EdidInfo *edid = &primary_screen_info.edid_info;
-        while (read_config_row(config_file, &row)) {
-            if (row.has_pnp && strcmp(row.pnp, (const char *) edid->pnp_id) != 0) continue;
-            if (row.has_product && row.product != edid->product_id) continue;
-            if (row.has_name && strcmp(row.name, edid->product_name) != 0) continue;
-            if (row.has_serial && strcmp(row.serial, edid->serial_number) != 0) continue;
-            if (row.has_dpi) dpi = row.dpi;
-            LOG(DEBUG, "matched line %d, dpi=%u", row.line, dpi);
+        return daemon_run(socket_path, use_shm ? shm_name : NULL, config_path, config_dir, index_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (set_xrdb && (display_list != NULL || drm_root != NULL)) {
+        LOG(ERROR, "--xrdb needs a single X display to probe");
+        return EXIT_FAILURE;
+    }
+
+    if (display_list != NULL) {
+        return batch_run(display_list, config_path, config_dir, index_path, all_outputs, (unsigned) timeout_ms)
+            ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (drm_root != NULL) {
+        static ScreenInfo outputs[SCREEN_INFO_MAX_OUTPUTS];
+        size_t num_outputs = 1;
+        stats_phase_begin(STATS_PHASE_PROBE);
+        if (all_outputs) {
+            num_outputs = screen_info_drm_outputs(drm_root, outputs, SCREEN_INFO_MAX_OUTPUTS);
+        } else if (!screen_info_drm_primary(drm_root, &outputs[0])) {
+            return EXIT_FAILURE;
         }
-        fclose(config_file);
+        stats_phase_end(STATS_PHASE_PROBE);
+        stats_phase_begin(STATS_PHASE_DPI);
+        uint16_t dpis[SCREEN_INFO_MAX_OUTPUTS];
+        size_t num_dpis = dpi_suggest_all(config_path, config_dir, index_path, outputs, num_outputs, dpis);
+        stats_phase_end(STATS_PHASE_DPI);
+        bool ok = report_infos(&formats, all_outputs, outputs, dpis, num_outputs);
+        return ok && num_dpis > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (timeout_ms > 0) {
+        uint64_t deadline = screen_info_deadline_after((unsigned) timeout_ms);
+        return probe_until(deadline, &formats, use_cache, all_outputs, set_xrdb, config_path, config_dir, index_path);
     }
 
-    if (dpi != 0) {
-        printf("%u\n", dpi);
-        return EXIT_SUCCESS;
+    // the config is parsed on a helper thread while the X round trips are in flight; with the
+    // cache it is only started once the cache turned out to be stale
+    DpiConfigPrefetch *prefetch = NULL;
+    if (all_outputs || !use_cache) {
+        prefetch = dpi_config_prefetch(config_path, config_dir, index_path);
     }
 
-    unsigned physical_width = primary_screen_info.edid_info.physical_width;
-    unsigned physical_height = primary_screen_info.edid_info.physical_height;
-    if (physical_width == 0 || physical_height == 0) {
-        LOG(INFO, "real monitor size is unknown");
+    stats_phase_begin(STATS_PHASE_CONNECT);
+    struct xcb_connection_t *conn = screen_info_connect();
+    if (conn == NULL) {
+        dpi_config_abandon(prefetch);
         return EXIT_FAILURE;
     }
+    stats_phase_end(STATS_PHASE_CONNECT);
 
-    unsigned screen_width = primary_screen_info.geometry.width;
-    unsigned screen_height = primary_screen_info.geometry.height;
-    if (screen_width == 0 || screen_height == 0) {
-        LOG(ERROR, "failed to get primary screen size");
+    if (all_outputs) {
+        static ScreenInfo outputs[SCREEN_INFO_MAX_OUTPUTS];
+        stats_phase_begin(STATS_PHASE_PROBE);
+        size_t num_outputs = screen_info_outputs(conn, outputs, SCREEN_INFO_MAX_OUTPUTS);
+        stats_phase_end(STATS_PHASE_PROBE);
+        stats_phase_begin(STATS_PHASE_DPI);
+        uint16_t dpis[SCREEN_INFO_MAX_OUTPUTS];
+        size_t num_dpis = suggest_dpis(prefetch, config_path, config_dir, index_path, outputs, num_outputs, dpis);
+        stats_phase_end(STATS_PHASE_DPI);
+        bool ok = report_infos(&formats, true, outputs, dpis, num_outputs);
+        ok = (!set_xrdb || update_xrdb(conn, outputs, dpis, num_outputs, 0)) && ok;
+        screen_info_disconnect(conn);
+        return ok && num_dpis > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    uint16_t dpi = 0;
+    ScreenInfo primary_screen_info;
+    const char *display = use_cache ? getenv("DISPLAY") : NULL;
+    stats_phase_begin(STATS_PHASE_CACHE);
+    bool cached = display != NULL && cache_load(display, config_path, config_dir, &primary_screen_info, &dpi);
+    stats_phase_end(STATS_PHASE_CACHE);
+
+    ScreenStamp stamp;
+    uint64_t edid_hash = 0;
+    stats_phase_begin(STATS_PHASE_STAMP);
+    bool stamped = cached ? screen_info_stamp_check(conn, &stamp, &primary_screen_info, &edid_hash)
+                          : screen_info_stamp(conn, &stamp);
+    if (!stamped) {
+        dpi_config_abandon(prefetch);
+        screen_info_disconnect(conn);
         return EXIT_FAILURE;
     }
+    stats_phase_end(STATS_PHASE_STAMP);
 
-    static const double INCH_PER_CM = 0.3937008;
-    double fdpi = sqrt((pow(screen_width, 2) + pow(screen_height, 2))
-                           / (pow(physical_width * INCH_PER_CM, 2) + pow(physical_height * INCH_PER_CM, 2)));
-    LOG(DEBUG, "raw dpi: %g", fdpi);
+    if (cached && cache_valid(&primary_screen_info, &stamp, edid_hash)) {
+        bool ok = report_infos(&formats, false, &primary_screen_info, &dpi, 1);
+        ok = (!set_xrdb || xresources_set_dpi(conn, dpi, 0)) && ok;
+        screen_info_disconnect(conn);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (use_cache) {
+        prefetch = dpi_config_prefetch(config_path, config_dir, index_path);
+    }
 
-    dpi = (uint16_t) ((fdpi + 12) / 24) * 24;
-    printf("%u\n", dpi);
+    stats_phase_begin(STATS_PHASE_PROBE);
+    bool ok = screen_info_primary(conn, &stamp, &primary_screen_info);
+    // the connection stays open for --xrdb
+    if (!set_xrdb) {
+        screen_info_disconnect(conn);
+        conn = NULL;
+    }
+    if (!ok) {
+        dpi_config_abandon(prefetch);
+        screen_info_disconnect(conn);
+        return EXIT_FAILURE;
+    }
+    stats_phase_end(STATS_PHASE_PROBE);
 
-    return EXIT_SUCCESS;
+    stats_phase_begin(STATS_PHASE_DPI);
+    if (suggest_dpis(prefetch, config_path, config_dir, index_path, &primary_screen_info, 1, &dpi) == 0) {
+        screen_info_disconnect(conn);
+        return EXIT_FAILURE;
+    }
+    stats_phase_end(STATS_PHASE_DPI);
+    cache_store(display, config_path, config_dir, &primary_screen_info, dpi);
+    ok = report_infos(&formats, false, &primary_screen_info, &dpi, 1);
+    ok = (!set_xrdb || xresources_set_dpi(conn, dpi, 0)) && ok;
+    screen_info_disconnect(conn);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
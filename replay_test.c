@@ -0,0 +1,134 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_count.h"
+#include "dpi.h"
+#include "log.h"
+#include "screen_info.h"
+#include "screen_info_replay.h"
+#include "stats.h"
+
+// Regression tests of the primary output probe against the recordings in testdata/, so they
+// run on any machine without an X server. The recordings were made with
+//     suggestdpi --no-cache --config-dir= --record=FILE
+// against a stub X server with two connected outputs, the primary one with a 256 byte EDID
+// (primary_short.rec) or a 640 byte one (primary_long.rec). replay.conf matches the long one
+// only, the short one gets the dpi of its physical size. A probe that sends a request the
+// recording has no reply for fails, the replay server logs its sequence number and opcode.
+//
+// usage: suggestdpi_replay_test CHECK TESTDATA
+// CHECK is "replay" (dpi and X traffic of every recording), "round_trips" (the number of
+// times the probe blocks on the server: 4, one more when the EDID needs a second read) or
+// "allocs" (screen_info_primary allocates nothing but the replies libxcb reads).
+
+typedef struct ReplayCase {
+    const char *recording;
+    uint16_t    dpi;
+    size_t      x_requests;
+    size_t      x_round_trips;
+} ReplayCase;
+
+static const ReplayCase CASES[] = {
+    {"primary_short.rec", 168, 12, 4},
+    {"primary_long.rec", 240, 13, 5},
+};
+
+#define NUM_CASES (sizeof(CASES) / sizeof(CASES[0]))
+
+// the probe of the blocking path in main.c, on a connection to the replay server
+static size_t primary_allocs;
+
+static bool replay_probe(const char *testdata, const ReplayCase *test, ScreenInfo *restrict info)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", testdata, test->recording);
+    if (!screen_info_replay_start(path, 0)) return false;
+    stats_init();
+    struct xcb_connection_t *conn = screen_info_connect();
+    ScreenStamp stamp;
+    bool ok = conn != NULL && screen_info_stamp(conn, &stamp);
+    size_t allocs = alloc_count();
+    ok = ok && screen_info_primary(conn, &stamp, info);
+    primary_allocs = alloc_count() - allocs;
+    screen_info_disconnect(conn);
+    screen_info_replay_stop();
+    if (!ok) LOG(ERROR, "%s: probe failed", test->recording);
+    return ok;
+}
+
+static bool check_replay(const char *testdata, const ReplayCase *test)
+{
+    ScreenInfo info;
+    if (!replay_probe(testdata, test, &info)) return false;
+    size_t requests = stats_x_requests(), replies = stats_x_replies();
+    char config_path[PATH_MAX];
+    snprintf(config_path, sizeof(config_path), "%s/replay.conf", testdata);
+    uint16_t dpi = 0;
+    dpi_suggest(config_path, NULL, NULL, &info, &dpi);
+
+    bool ok = dpi == test->dpi && requests == test->x_requests && replies == requests;
+    if (!ok) {
+        LOG(ERROR, "%s: dpi %u, %zu requests, %zu replies; expected dpi %u, %zu requests with a reply each",
+            test->recording, dpi, requests, replies, test->dpi, test->x_requests);
+    }
+    return ok;
+}
+
+static bool check_round_trips(const char *testdata, const ReplayCase *test)
+{
+    ScreenInfo info;
+    if (!replay_probe(testdata, test, &info)) return false;
+    size_t round_trips = stats_x_round_trips();
+    if (round_trips != test->x_round_trips) {
+        LOG(ERROR, "%s: %zu round trips, expected %zu", test->recording, round_trips, test->x_round_trips);
+        return false;
+    }
+    return true;
+}
+
+static bool check_allocs(const char *testdata, const ReplayCase *test)
+{
+    ScreenInfo info;
+    if (!replay_probe(testdata, test, &info)) return false;
+    if (primary_allocs != 0) {
+        LOG(ERROR, "%s: screen_info_primary made %zu allocations of its own", test->recording, primary_allocs);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s CHECK TESTDATA\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool (*check)(const char *testdata, const ReplayCase *test) = NULL;
+    if (strcmp(argv[1], "replay") == 0) {
+        check = check_replay;
+    } else if (strcmp(argv[1], "round_trips") == 0) {
+        check = check_round_trips;
+    } else if (strcmp(argv[1], "allocs") == 0) {
+        check = check_allocs;
+        if (!alloc_count_ignore("libxcb.so")) {
+            LOG(ERROR, "libxcb is not loaded as a shared library, its replies cannot be told apart");
+            return EXIT_FAILURE;
+        }
+    } else {
+        LOG(ERROR, "unknown check %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    log_set_level(LOG_LEVEL_ERROR);
+    bool ok = true;
+    for (size_t i = 0; i < NUM_CASES; ++i) {
+        bool passed = check(argv[2], &CASES[i]);
+        fprintf(stderr, "%-24s %s\n", CASES[i].recording, passed ? "ok" : "FAILED");
+        ok = passed && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
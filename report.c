@@ -0,0 +1,206 @@
+#include "report.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static const char *FORMAT_NAMES[NumReportFormat] = {
+    "plain",
+    "xft",
+    "env",
+    "json",
+};
+
+#define REPORT_BUFFER_SIZE 16384
+
+typedef struct ReportWriter {
+    int    fd;
+    bool   ok;
+    size_t len;
+    char   buf[REPORT_BUFFER_SIZE];
+} ReportWriter;
+
+static void writer_flush(ReportWriter *writer)
+{
+    const char *data = writer->buf;
+    while (writer->ok && writer->len > 0) {
+        ssize_t written = write(writer->fd, data, writer->len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            LOG(ERROR, "failed to write the report: %s", strerror(errno));
+            writer->ok = false;
+            break;
+        }
+        data += written;
+        writer->len -= written;
+    }
+    writer->len = 0;
+}
+
+static void writer_put(ReportWriter *writer, const char *data, size_t len)
+{
+    while (len > 0) {
+        if (writer->len == sizeof(writer->buf)) writer_flush(writer);
+        size_t chunk = sizeof(writer->buf) - writer->len;
+        if (chunk > len) chunk = len;
+        memcpy(writer->buf + writer->len, data, chunk);
+        writer->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void writer_puts(ReportWriter *writer, const char *str)
+{
+    writer_put(writer, str, strlen(str));
+}
+
+__attribute__((format(printf, 2, 3)))
+static void writer_printf(ReportWriter *writer, const char *fmt, ...)
+{
+    // records are short, one that does not fit the rest of the buffer goes through the stack
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    writer_put(writer, line, (size_t) len < sizeof(line) ? (size_t) len : sizeof(line) - 1);
+}
+
+// JSON has no \xNN escapes, so this cannot share the C style quoting of format.c
+static void writer_json_string(ReportWriter *writer, const char *str)
+{
+    writer_put(writer, "\"", 1);
+    const char *run = str;
+    for (const char *ch = str; *ch != '\0'; ++ch) {
+        unsigned char byte = (unsigned char) *ch;
+        if (byte >= 0x20 && byte < 0x7f && byte != '"' && byte != '\\') continue;
+        writer_put(writer, run, ch - run);
+        if (byte == '"' || byte == '\\') {
+            char escaped[2] = {'\\', (char) byte};
+            writer_put(writer, escaped, 2);
+        } else {
+            writer_printf(writer, "\\u%04x", byte);
+        }
+        run = ch + 1;
+    }
+    writer_puts(writer, run);
+    writer_put(writer, "\"", 1);
+}
+
+bool report_parse_formats(const char *restrict spec, ReportFormats *restrict formats)
+{
+    formats->len = 0;
+    const char *name = spec;
+    for (;;) {
+        size_t len = strcspn(name, ",");
+        int found = -1;
+        for (int i = 0; i < NumReportFormat; ++i) {
+            if (strlen(FORMAT_NAMES[i]) == len && strncmp(name, FORMAT_NAMES[i], len) == 0) found = i;
+        }
+        if (found < 0) {
+            LOG(ERROR, "unknown output format: %.*s", (int) len, name);
+            return false;
+        }
+        bool seen = false;
+        for (size_t i = 0; i < formats->len; ++i) {
+            seen = seen || formats->list[i] == (ReportFormat) found;
+        }
+        if (!seen) formats->list[formats->len++] = (ReportFormat) found;
+        if (name[len] == '\0') return true;
+        name += len + 1;
+    }
+}
+
+static void write_plain(ReportWriter *writer, const ReportOutput *outputs, size_t num_outputs, bool all_outputs)
+{
+    for (size_t i = 0; i < num_outputs; ++i) {
+        const ReportOutput *output = &outputs[i];
+        if (all_outputs && output->name != NULL) {
+            writer_printf(writer, "%s %u%s\n", output->name, output->dpi, output->primary ? " primary" : "");
+        } else {
+            writer_printf(writer, "%u\n", output->dpi);
+        }
+    }
+}
+
+static void write_env(ReportWriter *writer, uint16_t dpi)
+{
+    // GDK only scales by whole numbers and makes up the rest with the font dpi
+    unsigned gdk_scale = dpi >= 96 ? dpi / 96u : 1;
+    writer_printf(writer, "export GDK_SCALE=%u\n", gdk_scale);
+    writer_printf(writer, "export GDK_DPI_SCALE=%g\n", (double) dpi / (96.0 * gdk_scale));
+    writer_puts(writer, "export QT_AUTO_SCREEN_SCALE_FACTOR=0\n");
+    writer_printf(writer, "export QT_SCALE_FACTOR=%g\n", (double) dpi / 96.0);
+}
+
+static void write_json(ReportWriter *writer, const ReportOutput *outputs, size_t num_outputs)
+{
+    for (size_t i = 0; i < num_outputs; ++i) {
+        const ReportOutput *output = &outputs[i];
+        writer_puts(writer, "{\"output\": ");
+        if (output->name != NULL) {
+            writer_json_string(writer, output->name);
+        } else {
+            writer_puts(writer, "null");
+        }
+        writer_printf(writer, ", \"dpi\": %u, \"primary\": %s", output->dpi, output->primary ? "true" : "false");
+        const EdidInfo *edid = output->edid;
+        if (edid != NULL) {
+            writer_puts(writer, ", \"pnp\": ");
+            writer_json_string(writer, edid->pnp_id);
+            char value[EDID_STRING_SIZE];
+            writer_printf(writer, ", \"product\": %u, \"name\": ", edid->product_id);
+            edid_string_copy(&edid->product_name, value);
+            writer_json_string(writer, value);
+            writer_puts(writer, ", \"serial\": ");
+            edid_string_copy(&edid->serial_number, value);
+            writer_json_string(writer, value);
+            writer_printf(writer, ", \"width_cm\": %u, \"height_cm\": %u", edid->physical_width,
+                          edid->physical_height);
+        }
+        writer_puts(writer, "}\n");
+    }
+}
+
+bool report_write(int fd, const ReportFormats *restrict formats, const ReportOutput *restrict outputs,
+                  size_t num_outputs, bool all_outputs)
+{
+    static ReportWriter writer;
+    writer.fd = fd;
+    writer.ok = true;
+    writer.len = 0;
+
+    const ReportOutput *primary = num_outputs > 0 ? &outputs[0] : NULL;
+    for (size_t i = 0; i < num_outputs; ++i) {
+        if (outputs[i].primary) {
+            primary = &outputs[i];
+            break;
+        }
+    }
+    for (size_t i = 0; i < formats->len; ++i) {
+        switch (formats->list[i]) {
+        case REPORT_PLAIN:
+            write_plain(&writer, outputs, num_outputs, all_outputs);
+            break;
+        case REPORT_XFT:
+            if (primary != NULL) writer_printf(&writer, "Xft.dpi: %u\n", primary->dpi);
+            break;
+        case REPORT_ENV:
+            if (primary != NULL) write_env(&writer, primary->dpi);
+            break;
+        case REPORT_JSON:
+            write_json(&writer, outputs, num_outputs);
+            break;
+        case NumReportFormat:
+            break;
+        }
+    }
+    writer_flush(&writer);
+    return writer.ok;
+}
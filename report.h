@@ -0,0 +1,44 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edid.h"
+
+// The result of one probe rendered in any number of formats at once. Everything goes
+// through one buffered writer and leaves in as few writes as the buffer allows, in the
+// order the formats were asked for:
+//   plain  the dpi, or "OUTPUT DPI[ primary]" per output
+//   xft    an X resource line for xrdb: "Xft.dpi: DPI"
+//   env    shell exports for GDK and Qt scaling
+//   json   one JSON object per output
+
+typedef enum ReportFormat {
+    REPORT_PLAIN,
+    REPORT_XFT,
+    REPORT_ENV,
+    REPORT_JSON,
+    NumReportFormat,
+} ReportFormat;
+
+typedef struct ReportFormats {
+    ReportFormat list[NumReportFormat];
+    size_t       len;
+} ReportFormats;
+
+typedef struct ReportOutput {
+    const char     *name; // NULL when only the dpi is known
+    uint16_t        dpi;
+    bool            primary;
+    const EdidInfo *edid; // NULL when only the dpi is known
+} ReportOutput;
+
+// a comma separated list of the names above
+bool report_parse_formats(const char *restrict spec, ReportFormats *restrict formats);
+// xft and env describe the primary output, or the first one when none is marked
+bool report_write(int fd, const ReportFormats *restrict formats, const ReportOutput *restrict outputs,
+                  size_t num_outputs, bool all_outputs);
+
+#endif // REPORT_H
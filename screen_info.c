@@ -1,17 +1,26 @@
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <xcb/randr.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 
 #include "buffer.h"
+#include "edid.h"
 #include "log.h"
 #include "format.h"
 #include "screen_info.h"
+#include "screen_info_replay.h"
+#include "stats.h"
 
 static const char *ATOM_NAMES[] = {
     "EDID\0",
@@ -26,120 +35,123 @@ typedef enum Atom {
     NumAtom,
 } Atom;
 
-#define SYNC_XCB_CALL(conn, func, ...) func##_reply(conn, func(conn, __VA_ARGS__), NULL)
+static void count_reply(unsigned sequence, const void *reply)
+{
+    const xcb_generic_reply_t *generic = reply;
+    stats_x_reply(sequence, generic ? 32 + (size_t) generic->length * 4 : 0);
+    screen_info_record_reply(sequence, reply);
+}
 
-static bool query_xcb_randr(xcb_connection_t *conn, uint32_t major_version, uint32_t minor_version)
+// RandR requests cannot be sent before the extension is known to be present, so the version
+// is asked for along with the first requests that need it rather than with the atoms
+static xcb_randr_query_version_cookie_t request_version(xcb_connection_t *conn)
 {
-    const xcb_query_extension_reply_t *ext_reply = xcb_get_extension_data(conn, &xcb_randr_id);
-    if (!ext_reply || !ext_reply->present) {
+    return xcb_randr_query_version(conn, 1, 6);
+}
+
+static bool check_version(const xcb_randr_query_version_reply_t *version)
+{
+    if (!version) {
+        LOG(ERROR, "failed to intialize xrandr");
         return false;
     }
-
-    xcb_randr_query_version_reply_t *reply = SYNC_XCB_CALL(conn, xcb_randr_query_version, major_version, minor_version);
-    if (!reply) {
+    if (version->major_version != 1 || version->minor_version < 2) {
+        LOG(ERROR, "xrandr %u.%u is too old, 1.2 or newer is needed", version->major_version, version->minor_version);
         return false;
     }
-    bool ok = (reply->major_version == 1 && reply->minor_version >= 2);
-    free(reply);
-    return ok;
+    return true;
 }
 
-static void init_xcb_atoms(xcb_connection_t *conn, const char *atom_names[], xcb_atom_t atoms[], size_t size)
+static xcb_window_t get_root_window(xcb_connection_t *conn)
 {
-    memset(atoms, 0, sizeof(xcb_atom_t) * size);
-
-    size_t cookie_size = sizeof(xcb_intern_atom_cookie_t) * size;
-    xcb_intern_atom_cookie_t *cookies = malloc(cookie_size);
-    if (cookies == NULL) return;
-    memset(cookies, 0, cookie_size);
+    return xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+}
 
-    for (size_t i = 0; i < size; ++i) {
-        cookies[i] = xcb_intern_atom(conn, 0, strlen(atom_names[i]), atom_names[i]);
-    }
-    for (size_t i = 0; i < size; ++i) {
-        xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(conn, cookies[i], NULL);
-        if (reply) {
-            atoms[i] = reply->atom;
-            free(reply);
-        } else {
-            atoms[i] = 0;
-        }
+static void request_atoms(xcb_connection_t *conn, xcb_intern_atom_cookie_t cookies[NumAtom])
+{
+    for (int i = 0; i < NumAtom; ++i) {
+        cookies[i] = xcb_intern_atom(conn, 0, strlen(ATOM_NAMES[i]), ATOM_NAMES[i]);
+        stats_x_request(cookies[i].sequence);
     }
-
-    free(cookies);
 }
 
-static xcb_window_t make_dummy_window(xcb_connection_t *conn)
+static void read_atoms(xcb_connection_t *conn, const xcb_intern_atom_cookie_t cookies[NumAtom], xcb_atom_t atoms[NumAtom])
 {
-    xcb_screen_t *first_screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
-    xcb_window_t window = xcb_generate_id(conn);
-    xcb_create_window(conn, 0, window, first_screen->root, 0, 0, 1, 1, 0, 0, 0, 0, NULL);
-    return window;
+    for (int i = 0; i < NumAtom; ++i) {
+        xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(conn, cookies[i], NULL);
+        count_reply(cookies[i].sequence, reply);
+        atoms[i] = reply ? reply->atom : 0;
+        free(reply);
+    }
+    LOG(DEBUG, "xcb atoms: [%s:%d, %s:%d, %s:%d]", ATOM_NAMES[0], atoms[0], ATOM_NAMES[1], atoms[1], ATOM_NAMES[2], atoms[2]);
 }
 
 static const xcb_randr_output_t NO_RANDR_OUTPUT = ~(xcb_randr_output_t)0;
 
-static xcb_randr_output_t get_output_primary(xcb_connection_t *conn, xcb_window_t window)
+static bool fill_output_info(ScreenInfo *info, xcb_randr_output_t output, xcb_randr_get_output_info_reply_t *reply,
+                             xcb_randr_crtc_t *crtc)
 {
-    xcb_randr_get_output_primary_reply_t *reply = SYNC_XCB_CALL(conn, xcb_randr_get_output_primary, window);
+    OutputGeometry geo = {0, 0, 0, 0, 0};
+    info->geometry = geo;
+    info->output = output;
+    memset(info->output_name, 0, sizeof(info->output_name));
+    *crtc = XCB_NONE;
     if (!reply) {
-        return NO_RANDR_OUTPUT;
+        return false;
     }
-    xcb_randr_output_t output = reply->output;
-    free(reply);
-    return output;
+    size_t name_len = xcb_randr_get_output_info_name_length(reply);
+    if (name_len >= sizeof(info->output_name)) name_len = sizeof(info->output_name) - 1;
+    memcpy(info->output_name, xcb_randr_get_output_info_name(reply), name_len);
+    *crtc = reply->crtc;
+    return reply->connection == XCB_RANDR_CONNECTION_CONNECTED;
 }
 
-static xcb_timestamp_t get_window_timestamp(xcb_connection_t *conn, xcb_window_t window)
+static void fill_crtc_info(ScreenInfo *info, const xcb_randr_get_crtc_info_reply_t *reply)
 {
-    xcb_randr_get_screen_resources_current_reply_t
-        *reply = SYNC_XCB_CALL(conn, xcb_randr_get_screen_resources_current, window);
     if (!reply) {
-        return 0;
+        return;
     }
-    xcb_timestamp_t ret = reply->timestamp;
-    free(reply);
-    return ret;
+    info->geometry.x = reply->x;
+    info->geometry.y = reply->y;
+    info->geometry.width = reply->width;
+    info->geometry.height = reply->height;
+    info->geometry.rotation = reply->rotation;
+}
+
+// the first request covers the base block and three extensions, a longer EDID reports the
+// rest in bytes_after and is completed by a second request for exactly that much
+static const uint32_t EDID_FIRST_LONGS = 128;
+// 32 EDID blocks, far more than displays carry
+#define EDID_JOIN_STACK 4096
+// a cached EDID is checked with a single read, longer ones are simply a miss
+#define EDID_CHECK_LONGS (EDID_JOIN_STACK / 4)
+
+static xcb_randr_get_output_property_cookie_t request_output_property(xcb_connection_t *conn, xcb_randr_output_t output, xcb_atom_t atom)
+{
+    xcb_randr_get_output_property_cookie_t cookie
+        = xcb_randr_get_output_property(conn, output, atom, XCB_ATOM_ANY, 0, EDID_FIRST_LONGS, false, false);
+    stats_x_request(cookie.sequence);
+    return cookie;
 }
 
-static OutputGeometry get_output_geometry(xcb_connection_t *conn, xcb_randr_output_t output, xcb_timestamp_t timestamp)
+static xcb_randr_get_output_property_cookie_t request_output_property_tail(
+    xcb_connection_t *conn, xcb_randr_output_t output, xcb_atom_t atom, const xcb_randr_get_output_property_reply_t *head)
 {
-    OutputGeometry geo = {0, 0, 0, 0, 0};
-    xcb_randr_get_output_info_reply_t *output_reply = SYNC_XCB_CALL(conn, xcb_randr_get_output_info, output, timestamp);
-    if (!output_reply) {
-        return geo;
-    }
-    xcb_randr_crtc_t crtc = output_reply->crtc;
-    free(output_reply);
-    xcb_randr_get_crtc_info_reply_t *reply = SYNC_XCB_CALL(conn, xcb_randr_get_crtc_info, crtc, timestamp);
-    if (!reply) {
-        return geo;
-    }
-    geo.x = reply->x;
-    geo.y = reply->y;
-    geo.width = reply->width;
-    geo.height = reply->height;
-    geo.rotation = reply->rotation;
-    free(reply);
-    return geo;
+    xcb_randr_get_output_property_cookie_t cookie = xcb_randr_get_output_property(
+        conn, output, atom, XCB_ATOM_ANY, head->num_items / 4, (head->bytes_after + 3) / 4, false, false);
+    stats_x_request(cookie.sequence);
+    return cookie;
 }
 
-static Buffer get_output_property(xcb_connection_t *conn, xcb_randr_output_t output, xcb_atom_t atom)
+static xcb_randr_get_output_property_reply_t *read_output_property(xcb_connection_t *conn,
+                                                                  xcb_randr_get_output_property_cookie_t cookie)
 {
-    Buffer buffer = {NULL, 0};
-    xcb_randr_get_output_property_reply_t
-        *reply = SYNC_XCB_CALL(conn, xcb_randr_get_output_property, output, atom, XCB_ATOM_ANY, 0, 100, false, false);
+    xcb_randr_get_output_property_reply_t *reply = xcb_randr_get_output_property_reply(conn, cookie, NULL);
+    count_reply(cookie.sequence, reply);
     if (!reply) {
-        LOG(DEBUG, "xcb randr get output property %d failed", atom);
-        return buffer;
-    }
-    buffer.len = reply->num_items;
-    if (buffer.len > 0) {
-        buffer.ptr = malloc(buffer.len);
-        memcpy(buffer.ptr, xcb_randr_get_output_property_data(reply), buffer.len);
+        LOG(DEBUG, "xcb randr get output property failed");
     }
-    free(reply);
-    return buffer;
+    return reply;
 }
 
 static const char *get_xcb_rotation_name(uint16_t rotation)
@@ -162,143 +174,278 @@ static const char *get_xcb_rotation_name(uint16_t rotation)
     }
 }
 
-static void copy_edid_string(char *dst, const uint8_t *ptr) {
-    memset(dst, 0, 16);
-    memcpy(dst, ptr, 13);
-    for (char *ch = dst; *ch != '\0'; ++ch) {
-        if (*ch == '\r' || *ch == '\n') {
-            *ch = '\0';
-        }
+typedef enum EdidStatus {
+    EDID_OK,
+    EDID_MISSING,
+    EDID_INVALID,
+} EdidStatus;
+
+// outputs listed by the screen resources (connected or not), their cookies live on the stack
+#define MAX_RANDR_OUTPUTS 256
+
+typedef struct OutputCookies {
+    xcb_randr_get_output_info_cookie_t     output_info;
+    xcb_randr_get_crtc_info_cookie_t       crtc_info;
+    xcb_randr_get_output_property_cookie_t edid[NumAtom];
+    bool                                   connected;
+    bool                                   has_crtc;
+} OutputCookies;
+
+static void request_output_edid(xcb_connection_t *conn, xcb_randr_output_t output, const xcb_atom_t atoms[NumAtom],
+                                OutputCookies *cookies)
+{
+    for (int i = 0; i < NumAtom; ++i) {
+        cookies->edid[i] = request_output_property(conn, output, atoms[i]);
     }
-    char *begin = dst;
-    while (*begin != '\0' && isspace(*begin)) ++begin;
-    char *end = begin + strlen(begin) - 1;
-    while (end >= begin && isspace(*end)) --end;
-    ++end;
-    for (char *s = begin, *d = dst; s < end; ++s, ++d) {
-        *d = *s;
+}
+
+// the first non-empty reply in atom order wins and the others are freed; returns its index, -1 for none
+static int pick_output_edid(xcb_randr_get_output_property_reply_t *replies[NumAtom])
+{
+    int picked = -1;
+    for (int i = 0; i < NumAtom; ++i) {
+        if (picked < 0 && replies[i] != NULL && replies[i]->num_items > 0) {
+            picked = i;
+            continue;
+        }
+        free(replies[i]);
+        replies[i] = NULL;
     }
-    *(dst + (end - begin)) = '\0';
+    return picked;
 }
 
-static bool parse_edid(Buffer buff, EdidInfo *edid)
+// takes ownership of both replies, the tail holds whatever did not fit into the head; an EDID
+// that fits is parsed straight out of the reply
+static EdidStatus take_output_edid(xcb_randr_get_output_property_reply_t *head,
+                                   xcb_randr_get_output_property_reply_t *tail, ScreenInfo *info)
 {
-    static const int EDID_PNP_ID_LO = 8;
-    static const int EDID_PNP_ID_HI = 9;
-    static const int EDID_PRODUCT = 10;
-    static const int EDID_SERIAL = 12;
-    static const int EDID_PHYSICAL_WIDTH = 21;
-    static const int EDID_PHYSICAL_HEIGHT = 22;
-    static const int EDID_DATA_BLOCKS = 54;
-    static const uint8_t EDID_HEADER[8] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+    if (head == NULL) {
+        free(tail);
+        return EDID_MISSING;
+    }
+    Buffer edid_buf = {xcb_randr_get_output_property_data(head), head->num_items};
+    // the two halves of a long EDID are joined on the stack, only giants go to the heap
+    uint8_t stack_join[EDID_JOIN_STACK];
+    uint8_t *joined = NULL;
+    if (tail != NULL && tail->num_items > 0) {
+        size_t len = edid_buf.len + tail->num_items;
+        joined = len <= sizeof(stack_join) ? stack_join : malloc(len);
+    }
+    if (joined != NULL) {
+        memcpy(joined, edid_buf.ptr, edid_buf.len);
+        memcpy(joined + edid_buf.len, xcb_randr_get_output_property_data(tail), tail->num_items);
+        edid_buf.ptr = joined;
+        edid_buf.len += tail->num_items;
+    }
 
-    memset(edid, 0, sizeof(EdidInfo));
+    info->edid_hash = hash_edid(edid_buf);
+    bool ok = parse_edid(edid_buf, &info->edid_info);
+    if (joined != stack_join) free(joined);
+    free(head);
+    free(tail);
+    return ok ? EDID_OK : EDID_INVALID;
+}
 
-    if (buff.len < 128) {
-        LOG(DEBUG, "edid length %lu insufficient", buff.len);
-        return false;
+static EdidStatus read_output_edid(xcb_connection_t *conn, xcb_randr_output_t output, const xcb_atom_t atoms[NumAtom],
+                                   const OutputCookies *cookies, ScreenInfo *info)
+{
+    // every reply has to be collected, even when an earlier one already has the EDID
+    xcb_randr_get_output_property_reply_t *replies[NumAtom];
+    for (int i = 0; i < NumAtom; ++i) {
+        replies[i] = read_output_property(conn, cookies->edid[i]);
     }
-    if (memcmp(EDID_HEADER, buff.ptr, sizeof(EDID_HEADER)) != 0) {
-        LOG(DEBUG, "edid header mismatch");
-        return false;
+    int picked = pick_output_edid(replies);
+    if (picked < 0) {
+        return EDID_MISSING;
+    }
+    info->edid_atom = atoms[picked];
+    xcb_randr_get_output_property_reply_t *tail = NULL;
+    if (replies[picked]->bytes_after > 0) {
+        tail = read_output_property(conn, request_output_property_tail(conn, output, atoms[picked], replies[picked]));
     }
+    return take_output_edid(replies[picked], tail, info);
+}
 
-    // PNP ID
-    edid->pnp_id[0] = (char) ('A' + ((buff.ptr[EDID_PNP_ID_LO] & 0x7cu) >> 2u) - 1);
-    edid->pnp_id[1] = (char) ('A' + ((buff.ptr[EDID_PNP_ID_LO] & 0x03u) << 3u) + ((buff.ptr[EDID_PNP_ID_HI] & 0xe0u) >> 5u) - 1);
-    edid->pnp_id[2] = (char) ('A' + (buff.ptr[EDID_PNP_ID_HI] & 0x1fu) - 1);
-    edid->pnp_id[3] = '\0';
+// A cached result names the output and property its EDID came from, so the EDID can be read
+// again without interning atoms and goes out with the stamp requests. Atoms only change with a
+// server restart, and a stale one fails the request or reads another property, both a miss.
+static xcb_randr_get_output_property_cookie_t request_edid_check(xcb_connection_t *conn, const ScreenInfo *cached)
+{
+    xcb_randr_get_output_property_cookie_t cookie = xcb_randr_get_output_property(
+        conn, cached->output, cached->edid_atom, XCB_ATOM_ANY, 0, EDID_CHECK_LONGS, false, false);
+    stats_x_request(cookie.sequence);
+    return cookie;
+}
 
-    // PRODUCT ID
-    edid->product_id = ((uint16_t) buff.ptr[EDID_PRODUCT])
-        + ((uint16_t) buff.ptr[EDID_PRODUCT + 1] << 8u);
+// 0 when the output has no such property any more or its EDID does not fit into one read
+static uint64_t hash_edid_check(const xcb_randr_get_output_property_reply_t *reply)
+{
+    if (reply == NULL || reply->format != 8 || reply->num_items == 0 || reply->bytes_after > 0) return 0;
+    Buffer edid_buf = {xcb_randr_get_output_property_data(reply), reply->num_items};
+    return hash_edid(edid_buf);
+}
+
+// The primary probe is scheduled by dependency, each step costs one round trip:
+//   1. QueryExtension                                       (screen_info_connect)
+//   2. QueryVersion, GetOutputPrimary, GetScreenResources   (screen_info_stamp, with
+//      GetOutputProperty of a cached output for screen_info_stamp_check)
+//   3. InternAtom x3, GetOutputInfo                         (screen_info_primary)
+//   4. GetOutputProperty x3, GetCrtcInfo                    (screen_info_primary)
+//   5. GetOutputProperty for the rest of an EDID longer than the first request
+struct xcb_connection_t *screen_info_connect(void)
+{
+    xcb_connection_t *conn = screen_info_replaying() ? screen_info_replay_connect() : xcb_connect(NULL, NULL);
+    if (conn == NULL || xcb_connection_has_error(conn)) {
+        LOG(ERROR, "failed to connect to X server");
+        xcb_disconnect(conn);
+        return NULL;
+    }
+    if (!screen_info_prepare(conn)) {
+        xcb_disconnect(conn);
+        return NULL;
+    }
+    return conn;
+}
 
-    // SERIAL
-    edid->serial_num = ((uint32_t) buff.ptr[EDID_SERIAL])
-        + ((uint32_t) buff.ptr[EDID_SERIAL + 1] << 8u)
-        + ((uint32_t) buff.ptr[EDID_SERIAL + 2] << 16u)
-        + ((uint32_t) buff.ptr[EDID_SERIAL + 3] << 24u);
+bool screen_info_prepare(struct xcb_connection_t *conn)
+{
+    // xcb_get_extension_data sends QueryExtension as the first request and waits for it,
+    // on a connection that already knows about RandR it is answered from the xcb cache
+    const xcb_query_extension_reply_t *ext_reply = xcb_get_extension_data(conn, &xcb_randr_id);
+    stats_x_request(1);
+    stats_x_reply(1, ext_reply ? 32 : 0);
+    screen_info_record_setup(conn, ext_reply);
+    if (!ext_reply || !ext_reply->present) {
+        LOG(ERROR, "failed to intialize xrandr");
+        return false;
+    }
+    return true;
+}
 
-    // SCREEN SIZE
-    edid->physical_width = buff.ptr[EDID_PHYSICAL_WIDTH];
-    edid->physical_height = buff.ptr[EDID_PHYSICAL_HEIGHT];
+void screen_info_disconnect(struct xcb_connection_t *conn)
+{
+    if (conn == NULL) return;
+    xcb_disconnect(conn);
+}
 
-    for (int i = 0; i < 5; ++i) {
-        int offset = EDID_DATA_BLOCKS + i * 18;
+static bool read_stamp(xcb_connection_t *conn, ScreenStamp *restrict stamp, const ScreenInfo *cached,
+                       uint64_t *restrict edid_hash)
+{
+    memset(stamp, 0, sizeof(ScreenStamp));
 
-        if (buff.ptr[offset] != 0 || buff.ptr[offset + 1] != 0 || buff.ptr[offset + 2] != 0) {
-            continue;
-        }
+    xcb_window_t root = get_root_window(conn);
+    xcb_randr_query_version_cookie_t version_cookie = request_version(conn);
+    xcb_randr_get_output_primary_cookie_t primary_cookie = xcb_randr_get_output_primary(conn, root);
+    xcb_randr_get_screen_resources_current_cookie_t
+        resources_cookie = xcb_randr_get_screen_resources_current(conn, root);
+    stats_x_request(version_cookie.sequence);
+    stats_x_request(primary_cookie.sequence);
+    stats_x_request(resources_cookie.sequence);
+    xcb_randr_get_output_property_cookie_t check_cookie = {0};
+    if (cached != NULL) check_cookie = request_edid_check(conn, cached);
 
-        switch (buff.ptr[offset + 3]) {
-        case 0xfc: // EDID_DESC_PRODUCT_NAME
-            copy_edid_string(edid->product_name, buff.ptr + offset + 5);
-            break;
-        case 0xfe: // EDID_DESC_ALPHANUMERIC_STRING
-            copy_edid_string(edid->identifier, buff.ptr + offset + 5);
-            break;
-        case 0xff: // EDID_DESC_SERIAL_NUMBER
-            copy_edid_string(edid->serial_number, buff.ptr + offset + 5);
-            break;
-        }
+    xcb_randr_query_version_reply_t *version = xcb_randr_query_version_reply(conn, version_cookie, NULL);
+    count_reply(version_cookie.sequence, version);
+    bool version_ok = check_version(version);
+    free(version);
+    xcb_randr_get_output_primary_reply_t *primary = xcb_randr_get_output_primary_reply(conn, primary_cookie, NULL);
+    count_reply(primary_cookie.sequence, primary);
+    stamp->primary_output = primary ? primary->output : NO_RANDR_OUTPUT;
+    free(primary);
+    xcb_randr_get_screen_resources_current_reply_t
+        *resources = xcb_randr_get_screen_resources_current_reply(conn, resources_cookie, NULL);
+    count_reply(resources_cookie.sequence, resources);
+    bool resources_ok = resources != NULL;
+    if (resources_ok) {
+        stamp->timestamp = resources->timestamp;
+        stamp->config_timestamp = resources->config_timestamp;
+        free(resources);
+    }
+    if (cached != NULL) {
+        xcb_generic_error_t *error = NULL;
+        xcb_randr_get_output_property_reply_t *check = xcb_randr_get_output_property_reply(conn, check_cookie, &error);
+        count_reply(check_cookie.sequence, check);
+        *edid_hash = hash_edid_check(check);
+        free(check);
+        free(error);
     }
 
+    if (!version_ok) {
+        return false;
+    }
+    if (!resources_ok) {
+        LOG(ERROR, "failed to get xrandr screen resources");
+        return false;
+    }
+    LOG(DEBUG, "xcb primary output: 0x%08x", stamp->primary_output);
+    LOG(DEBUG, "xcb root timestamp: %u, config timestamp: %u", stamp->timestamp, stamp->config_timestamp);
     return true;
 }
 
-bool screen_info_primary(ScreenInfo *restrict info)
+bool screen_info_stamp(struct xcb_connection_t *conn, ScreenStamp *restrict stamp)
 {
-    xcb_connection_t *conn = xcb_connect(NULL, NULL);
-    xcb_atom_t atoms[NumAtom];
+    return read_stamp(conn, stamp, NULL, NULL);
+}
 
-    if (!query_xcb_randr(conn, 1, 6)) {
-        LOG(ERROR, "failed to intialize xrandr");
-        xcb_disconnect(conn);
-        return false;
-    }
+bool screen_info_stamp_check(struct xcb_connection_t *conn, ScreenStamp *restrict stamp, const ScreenInfo *restrict cached,
+                             uint64_t *restrict edid_hash)
+{
+    *edid_hash = 0;
+    return read_stamp(conn, stamp, cached, edid_hash);
+}
 
-    init_xcb_atoms(conn, ATOM_NAMES, atoms, NumAtom);
-    LOG(DEBUG, "xcb atoms: [%s:%d, %s:%d, %s:%d]", ATOM_NAMES[0], atoms[0], ATOM_NAMES[1], atoms[1], ATOM_NAMES[2], atoms[2]);
+bool screen_info_primary(struct xcb_connection_t *conn, const ScreenStamp *restrict stamp, ScreenInfo *restrict info)
+{
+    xcb_atom_t atoms[NumAtom];
+    xcb_intern_atom_cookie_t atom_cookies[NumAtom];
+    OutputCookies cookies;
+    xcb_randr_output_t primary = stamp->primary_output;
+
+    memset(info, 0, sizeof(ScreenInfo));
+    info->stamp = *stamp;
 
-    xcb_window_t window = make_dummy_window(conn);
-    LOG(DEBUG, "xcb window: 0x%08x", window);
-    xcb_randr_output_t primary = get_output_primary(conn, window);
-    LOG(DEBUG, "xcb primary output: 0x%08x", primary);
+    request_atoms(conn, atom_cookies);
+    cookies.output_info = xcb_randr_get_output_info(conn, primary, stamp->timestamp);
+    stats_x_request(cookies.output_info.sequence);
 
-    xcb_timestamp_t config_timestamp = get_window_timestamp(conn, window);
-    LOG(DEBUG, "xcb window config timestamp: %u", config_timestamp);
-    info->geometry = get_output_geometry(conn, primary, config_timestamp);
+    read_atoms(conn, atom_cookies, atoms);
+    request_output_edid(conn, primary, atoms, &cookies);
+    xcb_randr_crtc_t crtc;
+    xcb_randr_get_output_info_reply_t *output_reply = xcb_randr_get_output_info_reply(conn, cookies.output_info, NULL);
+    count_reply(cookies.output_info.sequence, output_reply);
+    fill_output_info(info, primary, output_reply, &crtc);
+    free(output_reply);
+    cookies.has_crtc = crtc != XCB_NONE;
+    if (cookies.has_crtc) {
+        cookies.crtc_info = xcb_randr_get_crtc_info(conn, crtc, stamp->timestamp);
+        stats_x_request(cookies.crtc_info.sequence);
+        xcb_randr_get_crtc_info_reply_t *crtc_reply = xcb_randr_get_crtc_info_reply(conn, cookies.crtc_info, NULL);
+        count_reply(cookies.crtc_info.sequence, crtc_reply);
+        fill_crtc_info(info, crtc_reply);
+        free(crtc_reply);
+    }
     LOG(DEBUG, "xcb primary geometry: [x:%d, y:%d, w:%u, h:%u, r:%s]",
         info->geometry.x, info->geometry.y,
         info->geometry.width, info->geometry.height,
         get_xcb_rotation_name(info->geometry.rotation));
 
-    Buffer edid_buf;
-    edid_buf = get_output_property(conn, primary, atoms[EDID]);
-    if (edid_buf.len == 0) {
-        edid_buf = get_output_property(conn, primary, atoms[EDID_DATA]);
-    }
-    if (edid_buf.len == 0) {
-        edid_buf = get_output_property(conn, primary, atoms[XFree86_DDC_EDID1_RAWDATA]);
-    }
-    if (edid_buf.len == 0) {
+    switch (read_output_edid(conn, primary, atoms, &cookies, info)) {
+    case EDID_OK:
+        break;
+    case EDID_MISSING:
         LOG(ERROR, "failed to get edid data");
-        xcb_disconnect(conn);
         return false;
-    }
-
-    if (!parse_edid(edid_buf, &info->edid_info)) {
+    case EDID_INVALID:
         LOG(ERROR, "failed to parse edid data");
-        xcb_disconnect(conn);
         return false;
     }
     LOG(  DEBUG, "xcb randr edid data:");
     LOGBM(DEBUG, out, "  - pnp_id: ") fmt_quote_string(out, info->edid_info.pnp_id);
     LOG(  DEBUG, "  - product_id: 0x%04" PRIx16, info->edid_info.product_id);
     LOG(  DEBUG, "  - serial_num: 0x%08" PRIx32, info->edid_info.serial_num);
-    LOGBM(DEBUG, out, "  - product_name: ") fmt_quote_string(out, info->edid_info.product_name);
-    LOGBM(DEBUG, out, "  - identifier: ") fmt_quote_string(out, info->edid_info.identifier);
-    LOGBM(DEBUG, out, "  - serial_number: ") fmt_quote_string(out, info->edid_info.serial_number);
+    LOGBM(DEBUG, out, "  - product_name: ") edid_string_quote(out, &info->edid_info.product_name);
+    LOGBM(DEBUG, out, "  - identifier: ") edid_string_quote(out, &info->edid_info.identifier);
+    LOGBM(DEBUG, out, "  - serial_number: ") edid_string_quote(out, &info->edid_info.serial_number);
     LOG(  DEBUG, "  - physical_width: %" PRIu8, info->edid_info.physical_width);
     LOG(  DEBUG, "  - physical_height: %" PRIu8, info->edid_info.physical_height);
     LOG(  DEBUG, "config template:");
@@ -307,13 +454,619 @@ bool screen_info_primary(ScreenInfo *restrict info)
         fmt_quote_string(out, info->edid_info.pnp_id);
         fprintf(out, " product=0x%04" PRIx16, info->edid_info.product_id);
         fputs(" name=", out);
-        fmt_quote_string(out, info->edid_info.product_name);
+        edid_string_quote(out, &info->edid_info.product_name);
         fputs(" serial=", out);
-        fmt_quote_string(out, info->edid_info.serial_number);
+        edid_string_quote(out, &info->edid_info.serial_number);
         fputs(" dpi=96 # change it to your desirable value", out);
     };
 
-    buffer_free(&edid_buf);
-    xcb_disconnect(conn);
     return true;
 }
+
+static void discard_output(xcb_connection_t *conn, const OutputCookies *cookies)
+{
+    if (cookies->has_crtc) {
+        xcb_discard_reply(conn, cookies->crtc_info.sequence);
+    }
+    for (int i = 0; i < NumAtom; ++i) {
+        xcb_discard_reply(conn, cookies->edid[i].sequence);
+    }
+}
+
+size_t screen_info_outputs(struct xcb_connection_t *conn, ScreenInfo *restrict infos, size_t cap)
+{
+    ScreenStamp stamp;
+    xcb_atom_t atoms[NumAtom];
+    xcb_intern_atom_cookie_t atom_cookies[NumAtom];
+
+    // round trip 1: everything that only needs the root window
+    xcb_window_t root = get_root_window(conn);
+    request_atoms(conn, atom_cookies);
+    xcb_randr_get_screen_resources_current_cookie_t
+        resources_cookie = xcb_randr_get_screen_resources_current(conn, root);
+    xcb_randr_get_output_primary_cookie_t primary_cookie = xcb_randr_get_output_primary(conn, root);
+    stats_x_request(resources_cookie.sequence);
+    stats_x_request(primary_cookie.sequence);
+
+    read_atoms(conn, atom_cookies, atoms);
+    xcb_randr_get_output_primary_reply_t *primary = xcb_randr_get_output_primary_reply(conn, primary_cookie, NULL);
+    count_reply(primary_cookie.sequence, primary);
+    stamp.primary_output = primary ? primary->output : NO_RANDR_OUTPUT;
+    free(primary);
+    xcb_randr_get_screen_resources_current_reply_t
+        *resources = xcb_randr_get_screen_resources_current_reply(conn, resources_cookie, NULL);
+    count_reply(resources_cookie.sequence, resources);
+    if (!resources) {
+        LOG(ERROR, "failed to get xrandr screen resources");
+        return 0;
+    }
+    stamp.timestamp = resources->timestamp;
+    stamp.config_timestamp = resources->config_timestamp;
+
+    const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(resources);
+    int num_outputs = xcb_randr_get_screen_resources_current_outputs_length(resources);
+    OutputCookies cookies[MAX_RANDR_OUTPUTS];
+    if (num_outputs > MAX_RANDR_OUTPUTS) {
+        LOG(WARN, "xrandr reports %d outputs, only the first %d are probed", num_outputs, MAX_RANDR_OUTPUTS);
+        num_outputs = MAX_RANDR_OUTPUTS;
+    }
+    memset(cookies, 0, sizeof(OutputCookies) * num_outputs);
+
+    // round trip 2: output info and all EDID candidates of every output
+    for (int i = 0; i < num_outputs; ++i) {
+        cookies[i].output_info = xcb_randr_get_output_info(conn, outputs[i], stamp.timestamp);
+        stats_x_request(cookies[i].output_info.sequence);
+        request_output_edid(conn, outputs[i], atoms, &cookies[i]);
+    }
+    size_t count = 0;
+    for (int i = 0; i < num_outputs; ++i) {
+        ScreenInfo scratch;
+        ScreenInfo *info = count < cap ? &infos[count] : &scratch;
+        xcb_randr_crtc_t crtc;
+        xcb_randr_get_output_info_reply_t *reply = xcb_randr_get_output_info_reply(conn, cookies[i].output_info, NULL);
+        count_reply(cookies[i].output_info.sequence, reply);
+        memset(info, 0, sizeof(ScreenInfo));
+        cookies[i].connected = fill_output_info(info, outputs[i], reply, &crtc) && count < cap;
+        free(reply);
+        if (cookies[i].connected) {
+            ++count;
+        }
+        // round trip 3 is sent while the output info replies are still being collected
+        if (cookies[i].connected && crtc != XCB_NONE) {
+            cookies[i].crtc_info = xcb_randr_get_crtc_info(conn, crtc, stamp.timestamp);
+            stats_x_request(cookies[i].crtc_info.sequence);
+            cookies[i].has_crtc = true;
+        }
+    }
+
+    count = 0;
+    for (int i = 0; i < num_outputs; ++i) {
+        if (!cookies[i].connected) {
+            discard_output(conn, &cookies[i]);
+            continue;
+        }
+        ScreenInfo *info = &infos[count++];
+        info->stamp = stamp;
+        if (cookies[i].has_crtc) {
+            xcb_randr_get_crtc_info_reply_t *reply = xcb_randr_get_crtc_info_reply(conn, cookies[i].crtc_info, NULL);
+            count_reply(cookies[i].crtc_info.sequence, reply);
+            fill_crtc_info(info, reply);
+            free(reply);
+        }
+        // an output without a usable EDID is still listed, it just cannot be matched by the config
+        if (read_output_edid(conn, outputs[i], atoms, &cookies[i], info) != EDID_OK) {
+            LOG(DEBUG, "xcb output %s has no usable edid data", info->output_name);
+        }
+        LOG(DEBUG, "xcb output %s: [x:%d, y:%d, w:%u, h:%u, r:%s]", info->output_name,
+            info->geometry.x, info->geometry.y, info->geometry.width, info->geometry.height,
+            get_xcb_rotation_name(info->geometry.rotation));
+    }
+
+    free(resources);
+    return count;
+}
+
+// The non-blocking probe runs the same requests as screen_info_outputs as a state machine
+// that only ever takes replies which have already arrived, so one thread can drive many
+// connections from its own poll loop:
+//   1. QueryExtension (prefetched), InternAtom x3
+//   2. QueryVersion, GetScreenResourcesCurrent, GetOutputPrimary, GetOutputProperty of a
+//      cached output
+//   3. GetOutputInfo, GetOutputProperty x3 per output
+//   4. GetCrtcInfo per connected output, GetOutputProperty for the rest of a long EDID
+// Replies come back in request order, so once the atoms are in the QueryExtension reply is
+// in the xcb queue as well and xcb_get_extension_data no longer blocks.
+
+typedef enum ProbeStage {
+    PROBE_STAGE_ATOMS,
+    PROBE_STAGE_RESOURCES,
+    PROBE_STAGE_OUTPUTS,
+    PROBE_STAGE_CRTCS,
+    PROBE_STAGE_DONE,
+} ProbeStage;
+
+typedef struct ProbeReply {
+    unsigned sequence;
+    void   **slot;
+} ProbeReply;
+
+typedef struct ProbeOutput {
+    xcb_randr_output_t                     output;
+    xcb_randr_get_output_info_reply_t     *info;
+    xcb_randr_get_crtc_info_reply_t       *crtc;
+    xcb_randr_get_output_property_reply_t *edid[NumAtom];
+    xcb_randr_get_output_property_reply_t *edid_tail;
+    int                                    edid_picked;
+} ProbeOutput;
+
+#define PROBE_MAX_PENDING (MAX_RANDR_OUTPUTS * (1 + NumAtom))
+
+struct ScreenInfoProbe {
+    xcb_connection_t                               *conn;
+    bool                                            all_outputs;
+    ProbeStage                                      stage;
+    xcb_randr_query_version_reply_t                *version;
+    ProbeReply                                      pending[PROBE_MAX_PENDING];
+    size_t                                          num_pending;
+    size_t                                          num_collected;
+    xcb_intern_atom_reply_t                        *atoms[NumAtom];
+    xcb_randr_get_screen_resources_current_reply_t *resources;
+    xcb_randr_get_output_primary_reply_t           *primary;
+    const ScreenInfo                               *check;
+    xcb_randr_get_output_property_reply_t          *check_reply;
+    ScreenStamp                                     stamp;
+    ProbeOutput                                     outputs[MAX_RANDR_OUTPUTS];
+    int                                             num_outputs;
+    ScreenInfo                                      infos[SCREEN_INFO_MAX_OUTPUTS];
+    size_t                                          num_infos;
+};
+
+static void probe_expect(ScreenInfoProbe *probe, unsigned sequence, void *slot)
+{
+    stats_x_request(sequence);
+    probe->pending[probe->num_pending].sequence = sequence;
+    probe->pending[probe->num_pending].slot = slot;
+    ++probe->num_pending;
+}
+
+// true once every reply of the current stage is in, never blocks
+static bool probe_collect(ScreenInfoProbe *probe)
+{
+    while (probe->num_collected < probe->num_pending) {
+        // later replies cannot have arrived before the oldest outstanding one
+        ProbeReply *pending = &probe->pending[probe->num_collected];
+        xcb_generic_error_t *error = NULL;
+        if (!xcb_poll_for_reply(probe->conn, pending->sequence, pending->slot, &error)) {
+            return false;
+        }
+        count_reply(pending->sequence, *pending->slot);
+        free(error);
+        ++probe->num_collected;
+    }
+    probe->num_pending = 0;
+    probe->num_collected = 0;
+    return true;
+}
+
+static void probe_request_resources(ScreenInfoProbe *probe)
+{
+    xcb_window_t root = get_root_window(probe->conn);
+    probe_expect(probe, request_version(probe->conn).sequence, &probe->version);
+    probe_expect(probe, xcb_randr_get_screen_resources_current(probe->conn, root).sequence, &probe->resources);
+    probe_expect(probe, xcb_randr_get_output_primary(probe->conn, root).sequence, &probe->primary);
+    if (probe->check != NULL) {
+        xcb_randr_get_output_property_cookie_t cookie = xcb_randr_get_output_property(
+            probe->conn, probe->check->output, probe->check->edid_atom, XCB_ATOM_ANY, 0, EDID_CHECK_LONGS, false, false);
+        probe_expect(probe, cookie.sequence, &probe->check_reply);
+    }
+}
+
+static bool probe_request_outputs(ScreenInfoProbe *probe)
+{
+    // an old server fails the resources request, the version says why
+    if (!check_version(probe->version)) {
+        return false;
+    }
+    if (!probe->resources) {
+        LOG(ERROR, "failed to get xrandr screen resources");
+        return false;
+    }
+    probe->stamp.timestamp = probe->resources->timestamp;
+    probe->stamp.config_timestamp = probe->resources->config_timestamp;
+    probe->stamp.primary_output = probe->primary ? probe->primary->output : NO_RANDR_OUTPUT;
+
+    const xcb_randr_output_t *outputs = xcb_randr_get_screen_resources_current_outputs(probe->resources);
+    int num_outputs = xcb_randr_get_screen_resources_current_outputs_length(probe->resources);
+    if (num_outputs > MAX_RANDR_OUTPUTS) {
+        LOG(WARN, "xrandr reports %d outputs, only the first %d are probed", num_outputs, MAX_RANDR_OUTPUTS);
+        num_outputs = MAX_RANDR_OUTPUTS;
+    }
+    for (int i = 0; i < num_outputs; ++i) {
+        if (!probe->all_outputs && outputs[i] != probe->stamp.primary_output) continue;
+        ProbeOutput *output = &probe->outputs[probe->num_outputs++];
+        output->output = outputs[i];
+        probe_expect(probe, xcb_randr_get_output_info(probe->conn, outputs[i], probe->stamp.timestamp).sequence,
+                     &output->info);
+        for (int j = 0; j < NumAtom; ++j) {
+            xcb_atom_t atom = probe->atoms[j] ? probe->atoms[j]->atom : XCB_NONE;
+            xcb_randr_get_output_property_cookie_t cookie
+                = xcb_randr_get_output_property(probe->conn, outputs[i], atom, XCB_ATOM_ANY, 0, EDID_FIRST_LONGS, false, false);
+            probe_expect(probe, cookie.sequence, &output->edid[j]);
+        }
+    }
+    if (probe->num_outputs == 0) {
+        LOG(ERROR, "failed to find the primary xrandr output");
+        return false;
+    }
+    return true;
+}
+
+static void probe_request_crtcs(ScreenInfoProbe *probe)
+{
+    for (int i = 0; i < probe->num_outputs; ++i) {
+        ProbeOutput *output = &probe->outputs[i];
+        if (!output->info || output->info->connection != XCB_RANDR_CONNECTION_CONNECTED) continue;
+        if (output->info->crtc != XCB_NONE) {
+            xcb_randr_get_crtc_info_cookie_t cookie
+                = xcb_randr_get_crtc_info(probe->conn, output->info->crtc, probe->stamp.timestamp);
+            probe_expect(probe, cookie.sequence, &output->crtc);
+        }
+        output->edid_picked = pick_output_edid(output->edid);
+        if (output->edid_picked >= 0 && output->edid[output->edid_picked]->bytes_after > 0) {
+            const xcb_randr_get_output_property_reply_t *head = output->edid[output->edid_picked];
+            xcb_randr_get_output_property_cookie_t cookie = xcb_randr_get_output_property(
+                probe->conn, output->output, probe->atoms[output->edid_picked]->atom, XCB_ATOM_ANY,
+                head->num_items / 4, (head->bytes_after + 3) / 4, false, false);
+            probe_expect(probe, cookie.sequence, &output->edid_tail);
+        }
+    }
+}
+
+static bool probe_finish(ScreenInfoProbe *probe)
+{
+    for (int i = 0; i < probe->num_outputs && probe->num_infos < SCREEN_INFO_MAX_OUTPUTS; ++i) {
+        ProbeOutput *output = &probe->outputs[i];
+        ScreenInfo *info = &probe->infos[probe->num_infos];
+        xcb_randr_crtc_t crtc;
+        memset(info, 0, sizeof(ScreenInfo));
+        if (!fill_output_info(info, output->output, output->info, &crtc)) continue;
+        info->stamp = probe->stamp;
+        fill_crtc_info(info, output->crtc);
+        xcb_randr_get_output_property_reply_t *head = NULL;
+        if (output->edid_picked >= 0) {
+            info->edid_atom = probe->atoms[output->edid_picked]->atom;
+            head = output->edid[output->edid_picked];
+            output->edid[output->edid_picked] = NULL;
+        }
+        EdidStatus status = take_output_edid(head, output->edid_tail, info);
+        output->edid_tail = NULL;
+        if (status != EDID_OK && !probe->all_outputs) {
+            LOG(ERROR, status == EDID_MISSING ? "failed to get edid data" : "failed to parse edid data");
+            return false;
+        }
+        if (status != EDID_OK) {
+            LOG(DEBUG, "xcb output %s has no usable edid data", info->output_name);
+        }
+        ++probe->num_infos;
+    }
+    return probe->num_infos > 0 || probe->all_outputs;
+}
+
+ScreenInfoProbe *screen_info_probe_start(struct xcb_connection_t *conn, bool all_outputs)
+{
+    ScreenInfoProbe *probe = calloc(1, sizeof(ScreenInfoProbe));
+    if (probe == NULL) return NULL;
+    probe->conn = conn;
+    probe->all_outputs = all_outputs;
+    probe->stage = PROBE_STAGE_ATOMS;
+    xcb_prefetch_extension_data(conn, &xcb_randr_id);
+    for (int i = 0; i < NumAtom; ++i) {
+        xcb_intern_atom_cookie_t cookie = xcb_intern_atom(conn, 0, strlen(ATOM_NAMES[i]), ATOM_NAMES[i]);
+        probe_expect(probe, cookie.sequence, &probe->atoms[i]);
+    }
+    xcb_flush(conn);
+    return probe;
+}
+
+ScreenInfoProbeState screen_info_probe_poll(ScreenInfoProbe *probe)
+{
+    while (probe->stage != PROBE_STAGE_DONE) {
+        if (xcb_connection_has_error(probe->conn)) {
+            LOG(ERROR, "lost connection to X server");
+            return SCREEN_INFO_PROBE_FAILED;
+        }
+        if (!probe_collect(probe)) {
+            return SCREEN_INFO_PROBE_PENDING;
+        }
+        switch (probe->stage) {
+        case PROBE_STAGE_ATOMS: {
+            const xcb_query_extension_reply_t *ext_reply = xcb_get_extension_data(probe->conn, &xcb_randr_id);
+            screen_info_record_setup(probe->conn, ext_reply);
+            if (!ext_reply || !ext_reply->present) {
+                LOG(ERROR, "failed to intialize xrandr");
+                return SCREEN_INFO_PROBE_FAILED;
+            }
+            probe_request_resources(probe);
+            probe->stage = PROBE_STAGE_RESOURCES;
+            break;
+        }
+        case PROBE_STAGE_RESOURCES:
+            if (!probe_request_outputs(probe)) return SCREEN_INFO_PROBE_FAILED;
+            probe->stage = PROBE_STAGE_OUTPUTS;
+            break;
+        case PROBE_STAGE_OUTPUTS:
+            probe_request_crtcs(probe);
+            probe->stage = PROBE_STAGE_CRTCS;
+            break;
+        case PROBE_STAGE_CRTCS:
+            if (!probe_finish(probe)) return SCREEN_INFO_PROBE_FAILED;
+            probe->stage = PROBE_STAGE_DONE;
+            break;
+        case PROBE_STAGE_DONE:
+            break;
+        }
+        xcb_flush(probe->conn);
+    }
+    return SCREEN_INFO_PROBE_DONE;
+}
+
+size_t screen_info_probe_result(const ScreenInfoProbe *probe, const ScreenInfo **infos)
+{
+    *infos = probe->infos;
+    return probe->stage == PROBE_STAGE_DONE ? probe->num_infos : 0;
+}
+
+void screen_info_probe_free(ScreenInfoProbe *probe)
+{
+    if (probe == NULL) return;
+    // replies still outstanding are dropped by xcb once the connection goes away
+    for (int i = 0; i < NumAtom; ++i) {
+        free(probe->atoms[i]);
+    }
+    free(probe->version);
+    free(probe->resources);
+    free(probe->primary);
+    free(probe->check_reply);
+    for (int i = 0; i < probe->num_outputs; ++i) {
+        free(probe->outputs[i].info);
+        free(probe->outputs[i].crtc);
+        free(probe->outputs[i].edid_tail);
+        for (int j = 0; j < NumAtom; ++j) {
+            free(probe->outputs[i].edid[j]);
+        }
+    }
+    free(probe);
+}
+
+uint64_t screen_info_deadline_after(unsigned timeout_ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec + (uint64_t) timeout_ms * 1000000u;
+}
+
+int screen_info_remaining_ms(uint64_t deadline)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+    if (now >= deadline) return 0;
+    uint64_t ms = (deadline - now + 999999u) / 1000000u;
+    return ms < INT32_MAX ? (int) ms : INT32_MAX;
+}
+
+// xcb_connect cannot be interrupted, it runs on a thread that is left behind at the deadline;
+// whichever side lets go of the attempt last frees it
+struct ScreenInfoConnect {
+    pthread_mutex_t   lock;
+    pthread_cond_t    done_cond;
+    char             *display;   // NULL for $DISPLAY
+    int               notify_fd; // an eventfd of the caller, -1 for none
+    xcb_connection_t *conn;
+    bool              done;
+    int               refs;
+};
+
+static void release_attempt(ScreenInfoConnect *attempt)
+{
+    pthread_mutex_lock(&attempt->lock);
+    bool last = --attempt->refs == 0;
+    pthread_mutex_unlock(&attempt->lock);
+    if (!last) return;
+    // nobody took the connection
+    if (attempt->conn != NULL) xcb_disconnect(attempt->conn);
+    pthread_cond_destroy(&attempt->done_cond);
+    pthread_mutex_destroy(&attempt->lock);
+    if (attempt->notify_fd >= 0) close(attempt->notify_fd);
+    free(attempt->display);
+    free(attempt);
+}
+
+static void *connect_thread(void *arg)
+{
+    ScreenInfoConnect *attempt = arg;
+    xcb_connection_t *conn = xcb_connect(attempt->display, NULL);
+    pthread_mutex_lock(&attempt->lock);
+    attempt->conn = conn;
+    attempt->done = true;
+    pthread_cond_signal(&attempt->done_cond);
+    pthread_mutex_unlock(&attempt->lock);
+    if (attempt->notify_fd >= 0) {
+        uint64_t one = 1;
+        if (write(attempt->notify_fd, &one, sizeof(one)) < 0) LOG(DEBUG, "failed to notify: %s", strerror(errno));
+    }
+    release_attempt(attempt);
+    return NULL;
+}
+
+ScreenInfoConnect *screen_info_connect_start(const char *display, int notify_fd)
+{
+    ScreenInfoConnect *attempt = calloc(1, sizeof(ScreenInfoConnect));
+    if (attempt == NULL) return NULL;
+    // the caller's string and fd may be gone by the time a left behind thread gets to them
+    attempt->notify_fd = notify_fd >= 0 ? fcntl(notify_fd, F_DUPFD_CLOEXEC, 0) : -1;
+    bool copied = (display == NULL || (attempt->display = strdup(display)) != NULL)
+        && (notify_fd < 0 || attempt->notify_fd >= 0);
+    if (!copied) {
+        if (attempt->notify_fd >= 0) close(attempt->notify_fd);
+        free(attempt->display);
+        free(attempt);
+        return NULL;
+    }
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&attempt->done_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutex_init(&attempt->lock, NULL);
+    attempt->refs = 2;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, connect_thread, attempt) != 0) {
+        attempt->refs = 1;
+        release_attempt(attempt);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return attempt;
+}
+
+bool screen_info_connect_ready(ScreenInfoConnect *attempt)
+{
+    pthread_mutex_lock(&attempt->lock);
+    bool done = attempt->done;
+    pthread_mutex_unlock(&attempt->lock);
+    return done;
+}
+
+struct xcb_connection_t *screen_info_connect_wait(ScreenInfoConnect *attempt, uint64_t deadline)
+{
+    struct timespec until = {(time_t) (deadline / 1000000000u), (long) (deadline % 1000000000u)};
+    pthread_mutex_lock(&attempt->lock);
+    int error = 0;
+    while (!attempt->done && error != ETIMEDOUT) {
+        error = pthread_cond_timedwait(&attempt->done_cond, &attempt->lock, &until);
+    }
+    xcb_connection_t *conn = attempt->conn;
+    attempt->conn = NULL;
+    pthread_mutex_unlock(&attempt->lock);
+    release_attempt(attempt);
+    return conn;
+}
+
+struct xcb_connection_t *screen_info_connect_until(uint64_t deadline)
+{
+    // the replay server answers the setup on the spot
+    if (screen_info_replaying()) {
+        xcb_connection_t *conn = screen_info_replay_connect();
+        if (conn != NULL && !xcb_connection_has_error(conn)) return conn;
+        LOG(ERROR, "failed to connect to X server");
+        xcb_disconnect(conn);
+        return NULL;
+    }
+
+    ScreenInfoConnect *attempt = screen_info_connect_start(NULL, -1);
+    if (attempt == NULL) return NULL;
+    xcb_connection_t *conn = screen_info_connect_wait(attempt, deadline);
+    if (conn == NULL) {
+        LOG(ERROR, "timed out connecting to X server");
+        return NULL;
+    }
+    if (xcb_connection_has_error(conn)) {
+        LOG(ERROR, "failed to connect to X server");
+        xcb_disconnect(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+// the stamp is known once the resources are in, the output requests are sent right after them
+static bool probe_has_stamp(const ScreenInfoProbe *probe)
+{
+    return probe->stage > PROBE_STAGE_RESOURCES;
+}
+
+static ScreenInfoProbeState probe_wait(ScreenInfoProbe *probe, uint64_t deadline, bool stamp_only)
+{
+    for (;;) {
+        ScreenInfoProbeState state = screen_info_probe_poll(probe);
+        if (state != SCREEN_INFO_PROBE_PENDING || (stamp_only && probe_has_stamp(probe))) return state;
+        int timeout = screen_info_remaining_ms(deadline);
+        if (timeout == 0) return SCREEN_INFO_PROBE_PENDING;
+        struct pollfd fd = {xcb_get_file_descriptor(probe->conn), POLLIN, 0};
+        if (poll(&fd, 1, timeout) < 0 && errno != EINTR) {
+            LOG(ERROR, "poll failed: %s", strerror(errno));
+            return SCREEN_INFO_PROBE_FAILED;
+        }
+    }
+}
+
+ScreenInfoProbeState screen_info_probe_wait(ScreenInfoProbe *probe, uint64_t deadline)
+{
+    return probe_wait(probe, deadline, false);
+}
+
+void screen_info_probe_check(ScreenInfoProbe *probe, const ScreenInfo *cached)
+{
+    probe->check = cached;
+}
+
+bool screen_info_probe_wait_stamp(ScreenInfoProbe *probe, uint64_t deadline, ScreenStamp *restrict stamp,
+                                  uint64_t *restrict edid_hash)
+{
+    if (probe_wait(probe, deadline, true) == SCREEN_INFO_PROBE_FAILED || !probe_has_stamp(probe)) return false;
+    *stamp = probe->stamp;
+    *edid_hash = hash_edid_check(probe->check_reply);
+    return true;
+}
+
+bool screen_info_core_size(struct xcb_connection_t *conn, OutputGeometry *restrict geometry,
+                           unsigned *restrict width_mm, unsigned *restrict height_mm)
+{
+    const xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    memset(geometry, 0, sizeof(OutputGeometry));
+    geometry->width = screen->width_in_pixels;
+    geometry->height = screen->height_in_pixels;
+    *width_mm = screen->width_in_millimeters;
+    *height_mm = screen->height_in_millimeters;
+    return *width_mm > 0 && *height_mm > 0;
+}
+
+int screen_info_fd(struct xcb_connection_t *conn)
+{
+    return xcb_get_file_descriptor(conn);
+}
+
+bool screen_info_watch(struct xcb_connection_t *conn)
+{
+    xcb_window_t root = get_root_window(conn);
+    xcb_void_cookie_t cookie = xcb_randr_select_input_checked(
+        conn, root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE | XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+    xcb_generic_error_t *error = xcb_request_check(conn, cookie);
+    if (error) {
+        LOG(ERROR, "failed to select xrandr events: error %u", error->error_code);
+        free(error);
+        return false;
+    }
+    return true;
+}
+
+int screen_info_poll_changes(struct xcb_connection_t *conn)
+{
+    const xcb_query_extension_reply_t *ext_reply = xcb_get_extension_data(conn, &xcb_randr_id);
+    int changed = 0;
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(conn)) != NULL) {
+        uint8_t type = event->response_type & 0x7fu;
+        if (type == ext_reply->first_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY
+            || type == ext_reply->first_event + XCB_RANDR_NOTIFY) {
+            changed = 1;
+        }
+        free(event);
+    }
+    if (xcb_connection_has_error(conn)) {
+        LOG(ERROR, "lost connection to X server");
+        return -1;
+    }
+    return changed;
+}
@@ -2,32 +2,73 @@
 #define SCREEN_INFO_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef struct OutputGeometry {
-    int16_t x;
-    int16_t y;
-    uint16_t width;
-    uint16_t height;
-    uint16_t rotation;
-} OutputGeometry;
-
-typedef struct EdidInfo {
-    char pnp_id[4];
-    uint16_t product_id;
-    uint32_t serial_num;
-    char product_name[16];
-    char identifier[16];
-    char serial_number[16];
-    uint8_t physical_width;
-    uint8_t physical_height;
-} EdidInfo;
-
-typedef struct ScreenInfo {
-    OutputGeometry geometry;
-    EdidInfo edid_info;
-} ScreenInfo;
-
-bool screen_info_primary(ScreenInfo *restrict info);
+#include "edid.h"
+
+#define SCREEN_INFO_MAX_OUTPUTS 64
+
+struct xcb_connection_t;
+
+struct xcb_connection_t *screen_info_connect(void);
+void screen_info_disconnect(struct xcb_connection_t *conn);
+// checks that RandR is available on a connection made elsewhere, the others must not be called otherwise
+bool screen_info_prepare(struct xcb_connection_t *conn);
+bool screen_info_stamp(struct xcb_connection_t *conn, ScreenStamp *restrict stamp);
+// the stamp plus the hash of the EDID the output of a cached result carries now, read in the
+// same round trip; the hash is 0 when that EDID is gone
+bool screen_info_stamp_check(struct xcb_connection_t *conn, ScreenStamp *restrict stamp, const ScreenInfo *restrict cached,
+                             uint64_t *restrict edid_hash);
+bool screen_info_primary(struct xcb_connection_t *conn, const ScreenStamp *restrict stamp, ScreenInfo *restrict info);
+size_t screen_info_outputs(struct xcb_connection_t *conn, ScreenInfo *restrict infos, size_t cap);
+
+// non-blocking variant of screen_info_primary/screen_info_outputs for callers with their own
+// poll loop: start it, then poll it whenever the connection fd is readable until it is done
+typedef struct ScreenInfoProbe ScreenInfoProbe;
+
+typedef enum ScreenInfoProbeState {
+    SCREEN_INFO_PROBE_PENDING,
+    SCREEN_INFO_PROBE_DONE,
+    SCREEN_INFO_PROBE_FAILED,
+} ScreenInfoProbeState;
+
+ScreenInfoProbe *screen_info_probe_start(struct xcb_connection_t *conn, bool all_outputs);
+ScreenInfoProbeState screen_info_probe_poll(ScreenInfoProbe *probe);
+size_t screen_info_probe_result(const ScreenInfoProbe *probe, const ScreenInfo **infos);
+void screen_info_probe_free(ScreenInfoProbe *probe);
+
+// deadlines are CLOCK_MONOTONIC nanoseconds; when one passes the call gives up and the
+// probe is left pending, a connection attempt keeps running on a thread of its own
+uint64_t screen_info_deadline_after(unsigned timeout_ms);
+int screen_info_remaining_ms(uint64_t deadline);
+struct xcb_connection_t *screen_info_connect_until(uint64_t deadline);
+
+// the connection attempt of screen_info_connect_until on its own, for callers connecting to
+// several displays at once: display is NULL for $DISPLAY, notify_fd an eventfd that is bumped
+// when the attempt is ready, or -1. Wait takes over the attempt and returns NULL when the
+// deadline passed first, else the connection, which may have an error.
+typedef struct ScreenInfoConnect ScreenInfoConnect;
+
+ScreenInfoConnect *screen_info_connect_start(const char *display, int notify_fd);
+bool screen_info_connect_ready(ScreenInfoConnect *attempt);
+struct xcb_connection_t *screen_info_connect_wait(ScreenInfoConnect *attempt, uint64_t deadline);
+ScreenInfoProbeState screen_info_probe_wait(ScreenInfoProbe *probe, uint64_t deadline);
+// has the probe read the EDID of a cached result along with the stamp, as screen_info_stamp_check
+// does; cached must outlive the probe and be set before it is first polled
+void screen_info_probe_check(ScreenInfoProbe *probe, const ScreenInfo *cached);
+// waits only until the stamp of screen_info_stamp is known, for a cache lookup before the rest
+// of the probe is waited for; false when the probe failed or the deadline passed first
+bool screen_info_probe_wait_stamp(ScreenInfoProbe *probe, uint64_t deadline, ScreenStamp *restrict stamp,
+                                  uint64_t *restrict edid_hash);
+
+// size of the core X screen, known from the connection setup without a round trip;
+// false when the server reports no physical size
+bool screen_info_core_size(struct xcb_connection_t *conn, OutputGeometry *restrict geometry,
+                           unsigned *restrict width_mm, unsigned *restrict height_mm);
+
+int screen_info_fd(struct xcb_connection_t *conn);
+bool screen_info_watch(struct xcb_connection_t *conn);
+int screen_info_poll_changes(struct xcb_connection_t *conn);
 
 #endif // SCREEN_INFO_H
@@ -0,0 +1,156 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "edid.h"
+#include "format.h"
+#include "log.h"
+#include "screen_info_drm.h"
+
+// 256 blocks of 128 bytes, the most an EDID with extensions can take
+#define DRM_MAX_EDID 32768
+// RandR's Rotate_0, sysfs does not expose the rotation of a connector
+#define DRM_ROTATION_NORMAL 1
+
+static size_t read_connector_file(const char *restrict sysfs_root, const char *restrict connector,
+                                  const char *restrict file, void *restrict buf, size_t cap)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s/%s", sysfs_root, connector, file) >= (int) sizeof(path)) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    size_t len = 0;
+    while (len < cap) {
+        ssize_t got = read(fd, (uint8_t *) buf + len, cap - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        len += got;
+    }
+    close(fd);
+    return len;
+}
+
+static size_t read_connector_line(const char *restrict sysfs_root, const char *restrict connector,
+                                  const char *restrict file, char *restrict buf, size_t cap)
+{
+    size_t len = read_connector_file(sysfs_root, connector, file, buf, cap - 1);
+    buf[len] = '\0';
+    char *newline = memchr(buf, '\n', len);
+    if (newline != NULL) {
+        *newline = '\0';
+        len = newline - buf;
+    }
+    return len;
+}
+
+// connector directories look like card0-HDMI-A-1, the bare cardN entries are the devices themselves
+static int is_connector(const struct dirent *entry)
+{
+    if (strncmp(entry->d_name, "card", 4) != 0) return 0;
+    const char *ptr = entry->d_name + 4;
+    if (*ptr < '0' || *ptr > '9') return 0;
+    while (*ptr >= '0' && *ptr <= '9') ++ptr;
+    return *ptr == '-' && ptr[1] != '\0';
+}
+
+static bool fill_connector_info(const char *restrict sysfs_root, const char *restrict connector,
+                                uint32_t ordinal, ScreenInfo *restrict info)
+{
+    char line[64];
+    read_connector_line(sysfs_root, connector, "status", line, sizeof(line));
+    if (strcmp(line, "connected") != 0) {
+        return false;
+    }
+
+    memset(info, 0, sizeof(ScreenInfo));
+    // connector_id only exists on newer kernels, the position in the listing is stable enough otherwise
+    info->output = ordinal;
+    if (read_connector_line(sysfs_root, connector, "connector_id", line, sizeof(line)) > 0) {
+        info->output = (uint32_t) strtoul(line, NULL, 10);
+    }
+    const char *name = strchr(connector, '-') + 1;
+    snprintf(info->output_name, sizeof(info->output_name), "%s", name);
+
+    // the preferred mode comes first, and it is the one the panel natively runs at
+    unsigned width = 0, height = 0;
+    read_connector_line(sysfs_root, connector, "modes", line, sizeof(line));
+    if (sscanf(line, "%ux%u", &width, &height) == 2 && width <= UINT16_MAX && height <= UINT16_MAX) {
+        info->geometry.width = (uint16_t) width;
+        info->geometry.height = (uint16_t) height;
+    }
+    info->geometry.rotation = DRM_ROTATION_NORMAL;
+
+    static uint8_t edid[DRM_MAX_EDID];
+    Buffer buff = {edid, read_connector_file(sysfs_root, connector, "edid", edid, sizeof(edid))};
+    if (buff.len == 0 || !parse_edid(buff, &info->edid_info)) {
+        LOG(DEBUG, "drm connector %s has no usable edid data", info->output_name);
+    } else {
+        info->edid_hash = hash_edid(buff);
+    }
+    LOG(DEBUG, "drm connector %s: [w:%u, h:%u]", info->output_name, info->geometry.width, info->geometry.height);
+    return true;
+}
+
+size_t screen_info_drm_outputs(const char *restrict sysfs_root, ScreenInfo *restrict infos, size_t cap)
+{
+    struct dirent **entries;
+    int num_entries = scandir(sysfs_root, &entries, is_connector, alphasort);
+    if (num_entries < 0) {
+        LOGB(ERROR, out) {
+            fputs("failed to list drm connectors in ", out);
+            fmt_quote_string(out, sysfs_root);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < num_entries; ++i) {
+        if (count < cap && fill_connector_info(sysfs_root, entries[i]->d_name, (uint32_t) i + 1, &infos[count])) {
+            ++count;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    // DRM has no notion of a primary output, the first connected one with an EDID stands in for it
+    uint32_t primary = 0;
+    for (size_t i = 0; i < count && primary == 0; ++i) {
+        if (infos[i].edid_info.pnp_id[0] != '\0') primary = infos[i].output;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        infos[i].stamp.primary_output = primary;
+    }
+    return count;
+}
+
+bool screen_info_drm_primary(const char *restrict sysfs_root, ScreenInfo *restrict info)
+{
+    static ScreenInfo outputs[SCREEN_INFO_MAX_OUTPUTS];
+    size_t num_outputs = screen_info_drm_outputs(sysfs_root, outputs, SCREEN_INFO_MAX_OUTPUTS);
+    for (size_t i = 0; i < num_outputs; ++i) {
+        if (outputs[i].output != outputs[i].stamp.primary_output) continue;
+        *info = outputs[i];
+        LOG(  DEBUG, "drm edid data:");
+        LOGBM(DEBUG, out, "  - pnp_id: ") fmt_quote_string(out, info->edid_info.pnp_id);
+        LOG(  DEBUG, "  - product_id: 0x%04" PRIx16, info->edid_info.product_id);
+        LOGBM(DEBUG, out, "  - product_name: ") edid_string_quote(out, &info->edid_info.product_name);
+        LOGBM(DEBUG, out, "  - serial_number: ") edid_string_quote(out, &info->edid_info.serial_number);
+        LOG(  DEBUG, "  - physical_width: %" PRIu8, info->edid_info.physical_width);
+        LOG(  DEBUG, "  - physical_height: %" PRIu8, info->edid_info.physical_height);
+        return true;
+    }
+    LOG(ERROR, "no connected drm connector with edid data");
+    return false;
+}
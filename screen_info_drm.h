@@ -0,0 +1,19 @@
+#ifndef SCREEN_INFO_DRM_H
+#define SCREEN_INFO_DRM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "screen_info.h"
+
+// Reads connectors straight from the kernel's DRM sysfs tree instead of asking an X server,
+// so it also works under Wayland, headless and early in boot. The root is normally
+// /sys/class/drm but can point at any directory laid out the same way. DRM has no primary
+// output, the first connected connector with an EDID is reported as the primary one.
+
+#define SCREEN_INFO_DRM_ROOT "/sys/class/drm"
+
+bool screen_info_drm_primary(const char *restrict sysfs_root, ScreenInfo *restrict info);
+size_t screen_info_drm_outputs(const char *restrict sysfs_root, ScreenInfo *restrict infos, size_t cap);
+
+#endif // SCREEN_INFO_DRM_H
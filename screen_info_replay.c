@@ -0,0 +1,459 @@
+#include "screen_info_replay.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "format.h"
+#include "log.h"
+
+// file layout: RecordFileHeader, then RecordHeader + length bytes per record; replies and the
+// setup are stored as they came off the wire, in the byte order of the recording host
+static const char RECORD_MAGIC[8] = {'S', 'D', 'P', 'I', 'R', 'E', 'C', '\0'};
+static const uint32_t RECORD_VERSION = 1;
+
+typedef struct RecordFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint8_t  byte_order; // 'l' or 'B', like the first byte of the connection setup
+    uint8_t  pad[3];
+} RecordFileHeader;
+
+typedef enum RecordKind {
+    RECORD_SETUP = 1,
+    RECORD_EXTENSION = 2, // the QueryExtension reply for RANDR
+    RECORD_REPLY = 3,
+} RecordKind;
+
+typedef struct RecordHeader {
+    uint8_t  kind;
+    uint8_t  pad[3];
+    uint32_t sequence;
+    uint32_t length;
+} RecordHeader;
+
+// requests of the probe are tiny, anything bigger means the replay went off the rails
+#define REPLAY_MAX_REQUEST 65536
+
+static const uint8_t X_QUERY_EXTENSION = 98;
+
+static uint8_t host_byte_order(void)
+{
+    const uint16_t probe = 1;
+    return *(const uint8_t *) &probe == 1 ? 'l' : 'B';
+}
+
+static __thread FILE *record_file;
+static __thread bool record_has_setup;
+
+static void write_record(RecordKind kind, uint32_t sequence, const void *data, uint32_t length)
+{
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.kind = (uint8_t) kind;
+    header.sequence = sequence;
+    header.length = length;
+    fwrite(&header, sizeof(header), 1, record_file);
+    fwrite(data, length, 1, record_file);
+}
+
+bool screen_info_record_start(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        LOGB(ERROR, out) {
+            fputs("failed to create recording ", out);
+            fmt_quote_string(out, path);
+            fprintf(out, ": %s", strerror(errno));
+        }
+        return false;
+    }
+    RecordFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    header.version = RECORD_VERSION;
+    header.byte_order = host_byte_order();
+    fwrite(&header, sizeof(header), 1, file);
+    screen_info_record_stop();
+    record_file = file;
+    record_has_setup = false;
+    return true;
+}
+
+bool screen_info_record_stop(void)
+{
+    if (record_file == NULL) return true;
+    bool ok = !ferror(record_file);
+    ok = fclose(record_file) == 0 && ok;
+    record_file = NULL;
+    if (!ok) {
+        LOG(ERROR, "failed to write the recording");
+    }
+    return ok;
+}
+
+void screen_info_record_setup(struct xcb_connection_t *conn, const void *extension_reply)
+{
+    if (record_file == NULL || record_has_setup) return;
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    write_record(RECORD_SETUP, 0, setup, 8 + (uint32_t) setup->length * 4);
+    if (extension_reply != NULL) {
+        write_record(RECORD_EXTENSION, 0, extension_reply, 32);
+    }
+    record_has_setup = true;
+}
+
+void screen_info_record_reply(unsigned sequence, const void *reply)
+{
+    // errors are not recorded, the replay gives up on a request it has no reply for
+    if (record_file == NULL || reply == NULL) return;
+    const xcb_generic_reply_t *generic = reply;
+    write_record(RECORD_REPLY, sequence, reply, 32 + (uint32_t) generic->length * 4);
+}
+
+typedef struct ReplayReply {
+    uint32_t       sequence;
+    uint32_t       length;
+    const uint8_t *data;
+} ReplayReply;
+
+// shared by every connection of one replay, whichever side lets go of it last frees it
+typedef struct ReplaySource {
+    pthread_mutex_t lock;
+    int             refs;
+    unsigned        latency_us;
+    uint8_t        *file;
+    const uint8_t  *setup;
+    size_t          setup_len;
+    const uint8_t  *extension;
+    ReplayReply    *replies;
+    size_t          num_replies;
+} ReplaySource;
+
+static __thread ReplaySource *replay_source;
+
+static void release_source(ReplaySource *source)
+{
+    pthread_mutex_lock(&source->lock);
+    bool last = --source->refs == 0;
+    pthread_mutex_unlock(&source->lock);
+    if (!last) return;
+    pthread_mutex_destroy(&source->lock);
+    free(source->replies);
+    free(source->file);
+    free(source);
+}
+
+static int compare_replies(const void *lhs, const void *rhs)
+{
+    uint32_t a = ((const ReplayReply *) lhs)->sequence;
+    uint32_t b = ((const ReplayReply *) rhs)->sequence;
+    return (a > b) - (a < b);
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    *len = 0;
+    for (;;) {
+        if (*len == cap) {
+            cap = cap ? cap * 2 : 65536;
+            uint8_t *grown = realloc(data, cap);
+            if (grown == NULL) break;
+            data = grown;
+        }
+        size_t n = fread(data + *len, 1, cap - *len, file);
+        *len += n;
+        if (n == 0) break;
+    }
+    bool ok = !ferror(file) && data != NULL && *len < cap;
+    fclose(file);
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static bool parse_recording(ReplaySource *source, size_t len)
+{
+    RecordFileHeader file_header;
+    if (len < sizeof(file_header)) return false;
+    memcpy(&file_header, source->file, sizeof(file_header));
+    if (memcmp(file_header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 || file_header.version != RECORD_VERSION) {
+        return false;
+    }
+    if (file_header.byte_order != host_byte_order()) {
+        LOG(ERROR, "recording was made on a host of the other byte order");
+        return false;
+    }
+
+    size_t cap = 0;
+    for (size_t offset = sizeof(file_header); offset < len;) {
+        RecordHeader header;
+        if (len - offset < sizeof(header)) return false;
+        memcpy(&header, source->file + offset, sizeof(header));
+        offset += sizeof(header);
+        if (len - offset < header.length) return false;
+        const uint8_t *data = source->file + offset;
+        offset += header.length;
+
+        switch (header.kind) {
+        case RECORD_SETUP:
+            source->setup = data;
+            source->setup_len = header.length;
+            break;
+        case RECORD_EXTENSION:
+            if (header.length != 32) return false;
+            source->extension = data;
+            break;
+        case RECORD_REPLY:
+            if (header.length < 32) return false;
+            if (source->num_replies == cap) {
+                cap = cap ? cap * 2 : 64;
+                ReplayReply *grown = realloc(source->replies, cap * sizeof(ReplayReply));
+                if (grown == NULL) return false;
+                source->replies = grown;
+            }
+            source->replies[source->num_replies].sequence = header.sequence;
+            source->replies[source->num_replies].length = header.length;
+            source->replies[source->num_replies].data = data;
+            ++source->num_replies;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (source->setup == NULL) return false;
+    qsort(source->replies, source->num_replies, sizeof(ReplayReply), compare_replies);
+    return true;
+}
+
+bool screen_info_replay_start(const char *path, unsigned latency_us)
+{
+    ReplaySource *source = calloc(1, sizeof(ReplaySource));
+    if (source == NULL) return false;
+    pthread_mutex_init(&source->lock, NULL);
+    source->refs = 1;
+    source->latency_us = latency_us;
+    size_t len;
+    source->file = read_file(path, &len);
+    if (source->file == NULL || !parse_recording(source, len)) {
+        LOGB(ERROR, out) {
+            fputs("failed to load recording ", out);
+            fmt_quote_string(out, path);
+        }
+        release_source(source);
+        return false;
+    }
+    LOG(DEBUG, "replay: %zu replies, %u us per round trip", source->num_replies, latency_us);
+    screen_info_replay_stop();
+    replay_source = source;
+    return true;
+}
+
+void screen_info_replay_stop(void)
+{
+    if (replay_source == NULL) return;
+    release_source(replay_source);
+    replay_source = NULL;
+}
+
+bool screen_info_replaying(void)
+{
+    return replay_source != NULL;
+}
+
+typedef struct ReplayServer {
+    ReplaySource *source;
+    int           fd;
+    uint32_t      sequence;
+    uint8_t      *out;
+    size_t        out_len;
+    size_t        out_cap;
+    uint8_t       in[REPLAY_MAX_REQUEST];
+} ReplayServer;
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (uint8_t *) buf + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t) n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len)
+{
+    for (size_t done = 0; done < len;) {
+        ssize_t n = send(fd, (const uint8_t *) buf + done, len - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += (size_t) n;
+    }
+    return true;
+}
+
+static uint8_t *server_append(ReplayServer *server, const void *data, size_t len)
+{
+    if (server->out_len + len > server->out_cap) {
+        size_t cap = server->out_cap ? server->out_cap : 4096;
+        while (cap < server->out_len + len) cap *= 2;
+        uint8_t *grown = realloc(server->out, cap);
+        if (grown == NULL) return NULL;
+        server->out = grown;
+        server->out_cap = cap;
+    }
+    uint8_t *dst = server->out + server->out_len;
+    memcpy(dst, data, len);
+    server->out_len += len;
+    // every reply and error carries the low 16 bits of the sequence number at offset 2
+    uint16_t sequence = (uint16_t) server->sequence;
+    memcpy(dst + 2, &sequence, sizeof(sequence));
+    return dst;
+}
+
+static bool server_answer(ReplayServer *server, const uint8_t *request, size_t size)
+{
+    const ReplaySource *source = server->source;
+    if (request[0] == X_QUERY_EXTENSION && size >= 8) {
+        uint16_t name_len;
+        memcpy(&name_len, request + 4, sizeof(name_len));
+        bool randr = source->extension != NULL && name_len == 5 && size >= 13 && memcmp(request + 8, "RANDR", 5) == 0;
+        uint8_t reply[32] = {1};
+        return server_append(server, randr ? source->extension : reply, 32) != NULL;
+    }
+
+    ReplayReply key = {server->sequence, 0, NULL};
+    const ReplayReply *reply = bsearch(&key, source->replies, source->num_replies, sizeof(ReplayReply), compare_replies);
+    if (reply != NULL) {
+        return server_append(server, reply->data, reply->length) != NULL;
+    }
+    // the probe went off the recording, an error reply would only hide that behind whatever the
+    // probe makes of it; the connection is dropped instead, so the probe fails where it diverged
+    if (request[0] >= 128) {
+        LOG(ERROR, "replay: unrecorded request seq %u opcode %u minor %u", server->sequence, request[0], request[1]);
+    } else {
+        LOG(ERROR, "replay: unrecorded request seq %u opcode %u", server->sequence, request[0]);
+    }
+    return false;
+}
+
+static bool serve_setup(ReplayServer *server)
+{
+    uint8_t request[12];
+    if (!read_full(server->fd, request, sizeof(request))) return false;
+    uint16_t name_len, data_len;
+    memcpy(&name_len, request + 6, sizeof(name_len));
+    memcpy(&data_len, request + 8, sizeof(data_len));
+    size_t auth_len = (size_t) ((name_len + 3) & ~3) + (size_t) ((data_len + 3) & ~3);
+    uint8_t auth[1024];
+    if (auth_len > sizeof(auth) || !read_full(server->fd, auth, auth_len)) return false;
+    return write_full(server->fd, server->source->setup, server->source->setup_len);
+}
+
+// everything read in one go is one round trip: the latency is paid once before the answers go out
+static void serve_requests(ReplayServer *server)
+{
+    uint8_t *in = server->in;
+    size_t in_len = 0;
+    for (;;) {
+        ssize_t n = read(server->fd, in + in_len, REPLAY_MAX_REQUEST - in_len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        in_len += (size_t) n;
+
+        size_t used = 0;
+        while (in_len - used >= 4) {
+            const uint8_t *request = in + used;
+            uint16_t length;
+            memcpy(&length, request + 2, sizeof(length));
+            size_t size = (size_t) length * 4;
+            if (size == 0) {
+                // BIG-REQUESTS: the real length follows the header
+                uint32_t big_length;
+                if (in_len - used < 8) break;
+                memcpy(&big_length, request + 4, sizeof(big_length));
+                size = (size_t) big_length * 4;
+            }
+            if (size < 4 || size > REPLAY_MAX_REQUEST) {
+                LOG(DEBUG, "replay: unexpected request of %zu bytes", size);
+                return;
+            }
+            if (in_len - used < size) break;
+            ++server->sequence;
+            if (!server_answer(server, request, size)) return;
+            used += size;
+        }
+        memmove(in, in + used, in_len - used);
+        in_len -= used;
+
+        if (server->out_len > 0) {
+            unsigned latency_us = server->source->latency_us;
+            struct timespec delay = {(time_t) (latency_us / 1000000u), (long) (latency_us % 1000000u) * 1000};
+            while (latency_us > 0 && nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+            }
+            if (!write_full(server->fd, server->out, server->out_len)) return;
+            server->out_len = 0;
+        }
+    }
+}
+
+static void *replay_thread(void *arg)
+{
+    ReplayServer *server = arg;
+    if (serve_setup(server)) {
+        serve_requests(server);
+    }
+    close(server->fd);
+    release_source(server->source);
+    free(server->out);
+    free(server);
+    return NULL;
+}
+
+struct xcb_connection_t *screen_info_replay_connect(void)
+{
+    ReplaySource *source = replay_source;
+    int fds[2];
+    if (source == NULL || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        LOG(ERROR, "failed to set up the replay connection");
+        return NULL;
+    }
+    ReplayServer *server = calloc(1, sizeof(ReplayServer));
+    if (server == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    server->source = source;
+    server->fd = fds[1];
+    pthread_mutex_lock(&source->lock);
+    ++source->refs;
+    pthread_mutex_unlock(&source->lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replay_thread, server) != 0) {
+        LOG(ERROR, "failed to start the replay server");
+        close(fds[0]);
+        close(fds[1]);
+        release_source(source);
+        free(server);
+        return NULL;
+    }
+    pthread_detach(thread);
+    // the connection owns fds[0] from here on, the server sees it close on xcb_disconnect
+    return xcb_connect_to_fd(fds[0], NULL);
+}
@@ -0,0 +1,30 @@
+#ifndef SCREEN_INFO_REPLAY_H
+#define SCREEN_INFO_REPLAY_H
+
+#include <stdbool.h>
+
+// Record/replay of the X traffic of a probe, so it can be profiled and regression tested
+// without the display it was captured on.
+//
+// While recording, the connection setup, the RandR extension data and every reply the probe
+// collects on the calling thread are appended to a file. While replaying, screen_info_connect
+// and screen_info_connect_until of the calling thread hand out connections to an in-process
+// server that answers each request with the reply recorded for its sequence number, after
+// latency_us per round trip. Sequence numbers only line up when the replay runs with the
+// options of the recording; a request without a recorded reply is logged with its sequence
+// number and opcode and the server drops the connection, so the probe fails.
+
+bool screen_info_record_start(const char *path);
+bool screen_info_record_stop(void);
+bool screen_info_replay_start(const char *path, unsigned latency_us);
+void screen_info_replay_stop(void);
+
+struct xcb_connection_t;
+
+// used by screen_info.c
+bool screen_info_replaying(void);
+struct xcb_connection_t *screen_info_replay_connect(void);
+void screen_info_record_setup(struct xcb_connection_t *conn, const void *extension_reply);
+void screen_info_record_reply(unsigned sequence, const void *reply);
+
+#endif // SCREEN_INFO_REPLAY_H
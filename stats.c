@@ -0,0 +1,115 @@
+#include "stats.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static const char *PHASE_NAMES[NumStatsPhase] = {
+    "connect",
+    "stamp",
+    "cache",
+    "probe",
+    "dpi",
+};
+
+typedef struct Stats {
+    uint64_t start_ns;
+    uint64_t phase_begin_ns[NumStatsPhase];
+    uint64_t phase_end_ns[NumStatsPhase];
+    size_t   x_requests;
+    size_t   x_replies;
+    size_t   x_round_trips;
+    size_t   x_bytes_received;
+    unsigned x_last_sequence;
+    unsigned x_flushed_sequence;
+    size_t   config_rows;
+    bool     config_index;
+} Stats;
+
+// per thread, so library callers probing from several threads do not race on them
+static __thread Stats stats;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void stats_init(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.start_ns = now_ns();
+}
+
+void stats_phase_begin(StatsPhase phase)
+{
+    stats.phase_begin_ns[phase] = now_ns();
+}
+
+void stats_phase_end(StatsPhase phase)
+{
+    stats.phase_end_ns[phase] = now_ns();
+}
+
+void stats_x_request(unsigned sequence)
+{
+    ++stats.x_requests;
+    stats.x_last_sequence = sequence;
+}
+
+void stats_x_reply(unsigned sequence, size_t bytes)
+{
+    ++stats.x_replies;
+    stats.x_bytes_received += bytes;
+    if (sequence > stats.x_flushed_sequence) {
+        // xcb flushes every queued request before it blocks, their replies arrive with this one
+        ++stats.x_round_trips;
+        stats.x_flushed_sequence = stats.x_last_sequence;
+    }
+}
+
+size_t stats_x_requests(void)
+{
+    return stats.x_requests;
+}
+
+size_t stats_x_replies(void)
+{
+    return stats.x_replies;
+}
+
+size_t stats_x_round_trips(void)
+{
+    return stats.x_round_trips;
+}
+
+void stats_config_row(void)
+{
+    ++stats.config_rows;
+}
+
+void stats_config_index(bool used)
+{
+    stats.config_index = used;
+}
+
+void stats_print(FILE *restrict stream)
+{
+    uint64_t end_ns = now_ns();
+    fputs("{\"phases\": {", stream);
+    bool first = true;
+    for (int i = 0; i < NumStatsPhase; ++i) {
+        if (stats.phase_begin_ns[i] == 0) continue;
+        uint64_t begin_ns = stats.phase_begin_ns[i];
+        uint64_t phase_end_ns = stats.phase_end_ns[i] >= begin_ns ? stats.phase_end_ns[i] : end_ns;
+        fprintf(stream, "%s\"%s\": {\"start_us\": %.3f, \"duration_us\": %.3f}", first ? "" : ", ", PHASE_NAMES[i],
+                (double) (begin_ns - stats.start_ns) / 1e3, (double) (phase_end_ns - begin_ns) / 1e3);
+        first = false;
+    }
+    fprintf(stream, "}, \"total_us\": %.3f", (double) (end_ns - stats.start_ns) / 1e3);
+    fprintf(stream, ", \"x_requests\": %zu, \"x_replies\": %zu, \"x_round_trips\": %zu, \"x_bytes_received\": %zu",
+            stats.x_requests, stats.x_replies, stats.x_round_trips, stats.x_bytes_received);
+    fprintf(stream, ", \"config_index\": %s, \"config_rows\": %zu}\n",
+            stats.config_index ? "true" : "false", stats.config_rows);
+}
@@ -0,0 +1,38 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Counters and phase timings of the calling thread for --stats. Recording is always on,
+// it is a handful of integer updates per run; only printing is optional.
+
+typedef enum StatsPhase {
+    STATS_PHASE_CONNECT,
+    STATS_PHASE_STAMP,
+    STATS_PHASE_CACHE,
+    STATS_PHASE_PROBE,
+    STATS_PHASE_DPI,
+    NumStatsPhase,
+} StatsPhase;
+
+// starts the clock and clears the counters of the calling thread
+void stats_init(void);
+void stats_phase_begin(StatsPhase phase);
+void stats_phase_end(StatsPhase phase);
+
+// X traffic: a round trip is counted when waiting for a reply whose request was not
+// yet flushed by an earlier wait, i.e. when the client really blocks on the server
+void stats_x_request(unsigned sequence);
+void stats_x_reply(unsigned sequence, size_t bytes);
+size_t stats_x_requests(void);
+size_t stats_x_replies(void);
+size_t stats_x_round_trips(void);
+
+void stats_config_row(void);
+void stats_config_index(bool used);
+
+void stats_print(FILE *restrict stream);
+
+#endif // STATS_H
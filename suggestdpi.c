@@ -0,0 +1,75 @@
+#include "suggestdpi.h"
+
+#include "dpi.h"
+#include "log.h"
+#include "screen_info.h"
+
+// every entry point logs through the caller's context and restores the previous one on the way out
+
+static const char *config_path_of(const SuggestDpiContext *context)
+{
+    return context->config_path ? context->config_path : DEFAULT_CONFIG_PATH;
+}
+
+void suggestdpi_init(SuggestDpiContext *restrict context)
+{
+    context->config_path = DEFAULT_CONFIG_PATH;
+    context->config_dir = DEFAULT_CONFIG_DIR;
+    context->index_path = NULL;
+    context->log.level = LOG_LEVEL_WARN;
+    context->log.output = NULL;
+}
+
+bool suggestdpi_probe(SuggestDpiContext *restrict context, struct xcb_connection_t *conn, ScreenInfo *restrict info)
+{
+    LogContext *previous = log_use_context(&context->log);
+    ScreenStamp stamp;
+    bool ok = screen_info_prepare(conn) && screen_info_stamp(conn, &stamp) && screen_info_primary(conn, &stamp, info);
+    log_use_context(previous);
+    return ok;
+}
+
+size_t suggestdpi_probe_all(SuggestDpiContext *restrict context, struct xcb_connection_t *conn,
+                            ScreenInfo *restrict infos, size_t cap)
+{
+    LogContext *previous = log_use_context(&context->log);
+    size_t num_infos = screen_info_prepare(conn) ? screen_info_outputs(conn, infos, cap) : 0;
+    log_use_context(previous);
+    return num_infos;
+}
+
+uint16_t suggestdpi_match_config(SuggestDpiContext *restrict context, const EdidInfo *restrict edid)
+{
+    LogContext *previous = log_use_context(&context->log);
+    uint16_t dpi = dpi_from_config(config_path_of(context), context->config_dir, context->index_path, edid);
+    log_use_context(previous);
+    return dpi;
+}
+
+uint16_t suggestdpi_compute(SuggestDpiContext *restrict context, const ScreenInfo *restrict info)
+{
+    LogContext *previous = log_use_context(&context->log);
+    uint16_t dpi;
+    if (!dpi_suggest(config_path_of(context), context->config_dir, context->index_path, info, &dpi)) {
+        dpi = 0;
+    }
+    log_use_context(previous);
+    return dpi;
+}
+
+size_t suggestdpi_compute_all(SuggestDpiContext *restrict context, const ScreenInfo *restrict infos, size_t num_infos,
+                              uint16_t *restrict dpis)
+{
+    LogContext *previous = log_use_context(&context->log);
+    size_t num_dpis = dpi_suggest_all(config_path_of(context), context->config_dir, context->index_path, infos,
+                                      num_infos, dpis);
+    log_use_context(previous);
+    return num_dpis;
+}
+
+uint16_t suggestdpi_primary_dpi(SuggestDpiContext *restrict context, struct xcb_connection_t *conn)
+{
+    ScreenInfo info;
+    if (!suggestdpi_probe(context, conn, &info)) return 0;
+    return suggestdpi_compute(context, &info);
+}
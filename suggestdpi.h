@@ -0,0 +1,47 @@
+#ifndef SUGGESTDPI_H
+#define SUGGESTDPI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "suggestdpi_types.h"
+
+// libsuggestdpi: what the suggestdpi executable does, as calls on a connection the embedder
+// already has. Nothing is kept between calls except the thread-local scratch state of the
+// matcher, so any number of threads may call in at once, each with its own context or all
+// sharing one that none of them modifies. Records are logged through the context's log.
+// The shared library exports these functions only, everything else stays internal.
+
+#define SUGGESTDPI_API __attribute__((visibility("default")))
+
+struct xcb_connection_t;
+
+typedef struct SuggestDpiContext {
+    const char *config_path; // NULL for DEFAULT_CONFIG_PATH
+    const char *config_dir;  // NULL for no drop-in directory
+    const char *index_path;  // NULL to always scan the config
+    LogContext  log;
+} SuggestDpiContext;
+
+// DEFAULT_CONFIG_PATH and DEFAULT_CONFIG_DIR, no index, warnings and errors to stderr
+SUGGESTDPI_API void suggestdpi_init(SuggestDpiContext *restrict context);
+
+// the primary output, or every connected output with its crtc; conn stays owned by the caller
+SUGGESTDPI_API bool suggestdpi_probe(SuggestDpiContext *restrict context, struct xcb_connection_t *conn,
+                                     ScreenInfo *restrict info);
+SUGGESTDPI_API size_t suggestdpi_probe_all(SuggestDpiContext *restrict context, struct xcb_connection_t *conn,
+                                           ScreenInfo *restrict infos, size_t cap);
+
+// the dpi of the last config row matching edid, 0 when none does
+SUGGESTDPI_API uint16_t suggestdpi_match_config(SuggestDpiContext *restrict context, const EdidInfo *restrict edid);
+
+// the config dpi, else the dpi from the physical size; 0 when neither is known
+SUGGESTDPI_API uint16_t suggestdpi_compute(SuggestDpiContext *restrict context, const ScreenInfo *restrict info);
+SUGGESTDPI_API size_t suggestdpi_compute_all(SuggestDpiContext *restrict context, const ScreenInfo *restrict infos,
+                                             size_t num_infos, uint16_t *restrict dpis);
+
+// probe and compute for the primary output in one call, 0 on failure
+SUGGESTDPI_API uint16_t suggestdpi_primary_dpi(SuggestDpiContext *restrict context, struct xcb_connection_t *conn);
+
+#endif // SUGGESTDPI_H
@@ -0,0 +1,69 @@
+#ifndef SUGGESTDPI_TYPES_H
+#define SUGGESTDPI_TYPES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the plain data types of the libsuggestdpi API, shared with the internal headers so that
+// suggestdpi.h does not have to pull those in
+
+typedef enum LogLevel {
+    LOG_LEVEL_TRACE,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+} LogLevel;
+
+// where records go and which are kept; every thread logs through its own current context,
+// so embedders can give each thread a different one without locking
+typedef struct LogContext {
+    LogLevel level;
+    FILE    *output; // NULL for stderr
+} LogContext;
+
+// a descriptor string as its raw bytes, copied out of the EDID because an EdidInfo outlives
+// the reply it was parsed from (cache file, shared memory, the daemon's state); it is only
+// trimmed and terminated when someone reads it; len is 0 when the EDID has no such descriptor
+typedef struct EdidString {
+    uint8_t len;
+    char raw[13];
+} EdidString;
+
+typedef struct EdidInfo {
+    char pnp_id[4];
+    uint16_t product_id;
+    uint32_t serial_num;
+    EdidString product_name;
+    EdidString identifier;
+    EdidString serial_number;
+    uint8_t physical_width;
+    uint8_t physical_height;
+} EdidInfo;
+
+typedef struct OutputGeometry {
+    int16_t x;
+    int16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint16_t rotation;
+} OutputGeometry;
+
+// identifies a RandR configuration: it changes whenever outputs are reconfigured, hotplugged or the primary moves
+typedef struct ScreenStamp {
+    uint32_t timestamp;
+    uint32_t config_timestamp;
+    uint32_t primary_output;
+} ScreenStamp;
+
+typedef struct ScreenInfo {
+    ScreenStamp stamp;
+    uint32_t output;
+    char output_name[32];
+    OutputGeometry geometry;
+    EdidInfo edid_info;
+    uint64_t edid_hash;
+    uint32_t edid_atom; // the RandR output property the EDID was read from, 0 outside of X
+} ScreenInfo;
+
+#endif // SUGGESTDPI_TYPES_H
@@ -0,0 +1,139 @@
+#include "xresources.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+#include "log.h"
+#include "screen_info.h"
+
+#define XFT_DPI_NAME "Xft.dpi"
+
+static void *wait_reply(xcb_connection_t *conn, unsigned sequence, uint64_t deadline, xcb_generic_error_t **error)
+{
+    if (deadline == 0) return xcb_wait_for_reply(conn, sequence, error);
+    for (;;) {
+        void *reply = NULL;
+        if (xcb_poll_for_reply(conn, sequence, &reply, error)) return reply;
+        if (xcb_connection_has_error(conn)) return NULL;
+        int timeout = screen_info_remaining_ms(deadline);
+        if (timeout == 0) {
+            LOG(ERROR, "xresources: deadline passed");
+            return NULL;
+        }
+        struct pollfd fd = {xcb_get_file_descriptor(conn), POLLIN, 0};
+        if (poll(&fd, 1, timeout) < 0 && errno != EINTR) return NULL;
+    }
+}
+
+// true when the line (without its newline) sets Xft.dpi: the name is compared up to the
+// colon, with the blanks xrdb allows around it
+static bool is_xft_dpi_line(const char *line, size_t len)
+{
+    const char *end = line + len;
+    while (line < end && (*line == ' ' || *line == '\t')) ++line;
+    size_t name_len = sizeof(XFT_DPI_NAME) - 1;
+    if ((size_t) (end - line) < name_len || memcmp(line, XFT_DPI_NAME, name_len) != 0) return false;
+    line += name_len;
+    while (line < end && (*line == ' ' || *line == '\t')) ++line;
+    return line < end && *line == ':';
+}
+
+// the database with every Xft.dpi entry dropped and one put in place of the first;
+// a value continued with a trailing backslash spans several lines and goes as a whole
+static char *replace_xft_dpi(const char *old, size_t old_len, uint16_t dpi, size_t *new_len)
+{
+    char entry[32];
+    int entry_len = snprintf(entry, sizeof(entry), XFT_DPI_NAME ":\t%u\n", dpi);
+    char *db = malloc(old_len + entry_len + 1);
+    if (db == NULL) return NULL;
+
+    size_t len = 0;
+    bool replaced = false;
+    const char *pos = old, *end = old + old_len;
+    while (pos < end) {
+        const char *line_end = pos;
+        for (;;) {
+            const char *newline = memchr(line_end, '\n', end - line_end);
+            line_end = newline ? newline + 1 : end;
+            if (newline == NULL || newline == pos || newline[-1] != '\\') break;
+        }
+        if (is_xft_dpi_line(pos, line_end - pos)) {
+            if (!replaced) {
+                memcpy(db + len, entry, entry_len);
+                len += entry_len;
+                replaced = true;
+            }
+        } else {
+            memcpy(db + len, pos, line_end - pos);
+            len += line_end - pos;
+            if (line_end == end && line_end[-1] != '\n') db[len++] = '\n';
+        }
+        pos = line_end;
+    }
+    if (!replaced) {
+        memcpy(db + len, entry, entry_len);
+        len += entry_len;
+    }
+    *new_len = len;
+    return db;
+}
+
+bool xresources_set_dpi(struct xcb_connection_t *conn, uint16_t dpi, uint64_t deadline)
+{
+    xcb_window_t root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+    // the length is in 32 bit units, this asks for all of it, whatever its type
+    xcb_get_property_cookie_t cookie
+        = xcb_get_property(conn, 0, root, XCB_ATOM_RESOURCE_MANAGER, XCB_ATOM_ANY, 0, UINT32_MAX / 4);
+    xcb_flush(conn);
+    xcb_generic_error_t *error = NULL;
+    xcb_get_property_reply_t *reply = wait_reply(conn, cookie.sequence, deadline, &error);
+    if (reply == NULL) {
+        LOG(ERROR, "xresources: failed to read RESOURCE_MANAGER%s", error ? "" : " before the deadline");
+        free(error);
+        return false;
+    }
+    // a database we cannot read as text is left alone rather than replaced by one line
+    if (reply->type != XCB_NONE && (reply->type != XCB_ATOM_STRING || reply->format != 8)) {
+        LOG(ERROR, "xresources: RESOURCE_MANAGER has type %u and format %u, not a string, leaving it alone",
+            reply->type, reply->format);
+        free(reply);
+        return false;
+    }
+    const char *old = xcb_get_property_value(reply);
+    size_t old_len = reply->type != XCB_NONE ? (size_t) xcb_get_property_value_length(reply) : 0;
+    size_t new_len;
+    char *db = replace_xft_dpi(old, old_len, dpi, &new_len);
+    free(reply);
+    if (db == NULL) {
+        LOG(ERROR, "xresources: %s", strerror(errno));
+        return false;
+    }
+
+    // the GetInputFocus reply can only come after the outcome of the ChangeProperty, so
+    // once it is in the check below returns without another round trip
+    xcb_void_cookie_t change = xcb_change_property_checked(conn, XCB_PROP_MODE_REPLACE, root,
+                                                           XCB_ATOM_RESOURCE_MANAGER, XCB_ATOM_STRING, 8,
+                                                           (uint32_t) new_len, db);
+    xcb_get_input_focus_cookie_t sync = xcb_get_input_focus(conn);
+    xcb_flush(conn);
+    free(db);
+    xcb_get_input_focus_reply_t *focus = wait_reply(conn, sync.sequence, deadline, NULL);
+    if (focus == NULL) {
+        LOG(ERROR, "xresources: no answer after writing RESOURCE_MANAGER");
+        return false;
+    }
+    free(focus);
+    error = xcb_request_check(conn, change);
+    if (error != NULL) {
+        LOG(ERROR, "xresources: failed to write RESOURCE_MANAGER: error %u", error->error_code);
+        free(error);
+        return false;
+    }
+    LOG(DEBUG, "xresources: " XFT_DPI_NAME " set to %u", dpi);
+    return true;
+}
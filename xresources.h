@@ -0,0 +1,15 @@
+#ifndef XRESOURCES_H
+#define XRESOURCES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct xcb_connection_t;
+
+// Sets Xft.dpi in the RESOURCE_MANAGER property of the root window on an open connection,
+// what `xrdb -merge` does for a single resource: every other line of the database is kept
+// byte for byte, the property is read once and written back with one ChangeProperty.
+// deadline is CLOCK_MONOTONIC nanoseconds as in screen_info.h, 0 waits as long as it takes.
+bool xresources_set_dpi(struct xcb_connection_t *conn, uint16_t dpi, uint64_t deadline);
+
+#endif // XRESOURCES_H
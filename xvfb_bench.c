@@ -0,0 +1,317 @@
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <xcb/randr.h>
+#include <xcb/xcb.h>
+
+#include "dpi.h"
+#include "format.h"
+#include "log.h"
+#include "screen_info.h"
+
+// End-to-end latency suite: starts a private Xvfb, attaches synthetic EDIDs to its RandR
+// output and runs the same connect/stamp/probe/dpi sequence as main.c against it. Every
+// case checks the suggested dpi and reports latency percentiles; the table goes to stderr,
+// one JSON object per case to stdout (or --output). Exits with 77 when Xvfb is missing.
+
+#define XVFB_EXIT_SKIP 77
+#define XVFB_WIDTH 1920
+#define XVFB_HEIGHT 1080
+
+typedef struct XvfbCase {
+    const char *name;
+    char        pnp[4];
+    uint16_t    product;
+    const char *product_name;
+    uint8_t     width_cm;
+    uint8_t     height_cm;
+    uint16_t    config_dpi; // 0 when no config row matches and the size decides
+} XvfbCase;
+
+static const XvfbCase CASES[] = {
+    {"size/24in", "GSM", 0x5b09, "LG FHD", 53, 30, 0},
+    {"size/13in", "BOE", 0x0747, "Panel", 29, 17, 0},
+    {"size/32in", "SAM", 0x0f35, "Odyssey", 70, 39, 0},
+    {"config/pnp", "DEL", 0xa0c1, "DELL U2720Q", 60, 34, 144},
+    {"config/name", "AUS", 0x27a1, "VG27A", 60, 34, 168},
+};
+
+static pid_t xvfb_pid = -1;
+
+static void stop_xvfb(void)
+{
+    if (xvfb_pid <= 0) return;
+    kill(xvfb_pid, SIGTERM);
+    waitpid(xvfb_pid, NULL, 0);
+    xvfb_pid = -1;
+}
+
+// missing is set when xvfb could not be executed at all, the suite is skipped then
+static xcb_connection_t *start_xvfb(const char *xvfb, char *display, size_t cap, bool *missing)
+{
+    *missing = false;
+    // pick the first display number without a lock file
+    int number = 90;
+    for (; number < 190; ++number) {
+        char lock[64];
+        snprintf(lock, sizeof(lock), "/tmp/.X%d-lock", number);
+        if (access(lock, F_OK) != 0) break;
+    }
+    snprintf(display, cap, ":%d", number);
+
+    char geometry[32];
+    snprintf(geometry, sizeof(geometry), "%dx%dx24", XVFB_WIDTH, XVFB_HEIGHT);
+    xvfb_pid = fork();
+    if (xvfb_pid < 0) {
+        LOG(ERROR, "failed to fork: %s", strerror(errno));
+        return NULL;
+    }
+    if (xvfb_pid == 0) {
+        freopen("/dev/null", "w", stderr);
+        execlp(xvfb, xvfb, display, "-screen", "0", geometry, "+extension", "RANDR", "-nolisten", "tcp",
+               (char *) NULL);
+        _exit(127);
+    }
+    atexit(stop_xvfb);
+
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        int status;
+        if (waitpid(xvfb_pid, &status, WNOHANG) == xvfb_pid) {
+            xvfb_pid = -1;
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+                LOG(ERROR, "%s not found", xvfb);
+                *missing = true;
+                return NULL;
+            }
+            LOG(ERROR, "%s exited during startup", xvfb);
+            return NULL;
+        }
+        xcb_connection_t *conn = xcb_connect(display, NULL);
+        if (!xcb_connection_has_error(conn)) return conn;
+        xcb_disconnect(conn);
+        struct timespec delay = {0, 25 * 1000 * 1000};
+        nanosleep(&delay, NULL);
+    }
+    LOG(ERROR, "%s did not come up on %s", xvfb, display);
+    return NULL;
+}
+
+static void build_edid(uint8_t edid[128], const XvfbCase *xcase)
+{
+    static const uint8_t header[8] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+    memset(edid, 0, 128);
+    memcpy(edid, header, sizeof(header));
+    uint16_t pnp = (uint16_t) (((xcase->pnp[0] - '@') << 10) | ((xcase->pnp[1] - '@') << 5) | (xcase->pnp[2] - '@'));
+    edid[8] = (uint8_t) (pnp >> 8u);
+    edid[9] = (uint8_t) pnp;
+    edid[10] = (uint8_t) xcase->product;
+    edid[11] = (uint8_t) (xcase->product >> 8u);
+    edid[18] = 1;
+    edid[19] = 4;
+    edid[21] = xcase->width_cm;
+    edid[22] = xcase->height_cm;
+    // a single monitor name descriptor, the other three stay dummies
+    uint8_t *desc = edid + 54 + 18;
+    desc[3] = 0xfc;
+    memset(desc + 5, ' ', 13);
+    size_t len = strlen(xcase->product_name);
+    memcpy(desc + 5, xcase->product_name, len);
+    desc[5 + len] = '\n';
+    for (int i = 2; i < 4; ++i) edid[54 + i * 18 + 3] = 0x10;
+    uint8_t sum = 0;
+    for (int i = 0; i < 127; ++i) sum += edid[i];
+    edid[127] = (uint8_t) -sum;
+}
+
+// attaches the EDID to the first output and makes it primary, which is what screen_info_primary looks for
+static bool attach_edid(xcb_connection_t *conn, const uint8_t edid[128])
+{
+    xcb_window_t root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+    xcb_intern_atom_reply_t *atom = xcb_intern_atom_reply(conn, xcb_intern_atom(conn, 0, 4, "EDID"), NULL);
+    xcb_randr_get_screen_resources_current_reply_t *resources = xcb_randr_get_screen_resources_current_reply(
+        conn, xcb_randr_get_screen_resources_current(conn, root), NULL);
+    bool ok = atom != NULL && resources != NULL && xcb_randr_get_screen_resources_current_outputs_length(resources) > 0;
+    if (ok) {
+        xcb_randr_output_t output = xcb_randr_get_screen_resources_current_outputs(resources)[0];
+        xcb_void_cookie_t property = xcb_randr_change_output_property_checked(
+            conn, output, atom->atom, XCB_ATOM_INTEGER, 8, XCB_PROP_MODE_REPLACE, 128, edid);
+        xcb_void_cookie_t primary = xcb_randr_set_output_primary_checked(conn, root, output);
+        xcb_generic_error_t *error = xcb_request_check(conn, property);
+        ok = error == NULL;
+        free(error);
+        error = xcb_request_check(conn, primary);
+        ok = ok && error == NULL;
+        free(error);
+    }
+    free(atom);
+    free(resources);
+    return ok;
+}
+
+// the same steps as the uncached path of main.c
+static bool probe(const char *config_path, uint16_t *dpi)
+{
+    struct xcb_connection_t *conn = screen_info_connect();
+    if (conn == NULL) return false;
+    ScreenStamp stamp;
+    ScreenInfo info;
+    bool ok = screen_info_stamp(conn, &stamp) && screen_info_primary(conn, &stamp, &info);
+    screen_info_disconnect(conn);
+    return ok && dpi_suggest(config_path, NULL, NULL, &info, dpi);
+}
+
+static int compare_ns(const void *lhs, const void *rhs)
+{
+    double a = *(const double *) lhs, b = *(const double *) rhs;
+    return a < b ? -1 : a > b;
+}
+
+static double percentile(const double *sorted, size_t len, double p)
+{
+    size_t i = (size_t) (p * (double) (len - 1) + 0.5);
+    return sorted[i];
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"output", required_argument, NULL, 'o'},
+    {"iterations", required_argument, NULL, 'n'},
+    {"xvfb", required_argument, NULL, 'x'},
+    {0, 0, 0, 0},
+};
+
+static void print_usage(const char *exe)
+{
+    static const char *usage =
+        "usage: %s [-h] [-o OUTPUT] [-n ITERATIONS] [-x XVFB]\n"
+        "\n"
+        "options:\n"
+        "    -h, --help\n"
+        "           show this help\n"
+        "    -o, --output=OUTPUT\n"
+        "           write the results as JSON lines to OUTPUT instead of stdout\n"
+        "    -n, --iterations=ITERATIONS\n"
+        "           probes per case (default: 200)\n"
+        "    -x, --xvfb=XVFB\n"
+        "           Xvfb executable (default: Xvfb)\n";
+    fprintf(stderr, usage, exe);
+}
+
+int main(int argc, char *argv[])
+{
+    int option_idx = 0, option_chr;
+    const char *output_path = NULL;
+    const char *xvfb = "Xvfb";
+    size_t iterations = 200;
+    while ((option_chr = getopt_long(argc, argv, "ho:n:x:", long_options, &option_idx)) != -1) {
+        switch (option_chr) {
+        case 'h':
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            xvfb = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations == 0) iterations = 1;
+
+    log_set_level(LOG_LEVEL_ERROR);
+    FILE *results = output_path ? fopen(output_path, "w") : stdout;
+    if (results == NULL) {
+        LOG(ERROR, "failed to open output: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char config_path[PATH_MAX];
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(config_path, sizeof(config_path), "%s/suggestdpi_xvfb.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int config_fd = mkstemp(config_path);
+    FILE *config = config_fd >= 0 ? fdopen(config_fd, "w") : NULL;
+    if (config == NULL) {
+        LOG(ERROR, "failed to create config: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(config, "pnp=\"DEL\" dpi=144\n");
+    fprintf(config, "pnp=\"AUS\" name=\"VG27A\" dpi=168\n");
+    fclose(config);
+
+    char display[16];
+    bool missing;
+    xcb_connection_t *conn = start_xvfb(xvfb, display, sizeof(display), &missing);
+    if (conn == NULL) {
+        unlink(config_path);
+        if (results != stdout) fclose(results);
+        return missing ? XVFB_EXIT_SKIP : EXIT_FAILURE;
+    }
+    setenv("DISPLAY", display, 1);
+
+    double *samples = calloc(iterations, sizeof(double));
+    bool all_ok = samples != NULL;
+    for (size_t c = 0; all_ok && c < sizeof(CASES) / sizeof(CASES[0]); ++c) {
+        const XvfbCase *xcase = &CASES[c];
+        uint8_t edid[128];
+        build_edid(edid, xcase);
+        if (!attach_edid(conn, edid)) {
+            LOG(ERROR, "%s: failed to attach edid, does Xvfb support RandR 1.3?", xcase->name);
+            all_ok = false;
+            break;
+        }
+        uint16_t expected = xcase->config_dpi
+            ? xcase->config_dpi : dpi_from_size(XVFB_WIDTH, XVFB_HEIGHT, xcase->width_cm, xcase->height_cm);
+
+        size_t failures = 0;
+        uint16_t dpi = 0;
+        for (size_t i = 0; i < iterations; ++i) {
+            double start = now_ns();
+            bool ok = probe(config_path, &dpi);
+            samples[i] = now_ns() - start;
+            if (!ok || dpi != expected) ++failures;
+        }
+        qsort(samples, iterations, sizeof(double), compare_ns);
+        double p50 = percentile(samples, iterations, 0.50) / 1e3;
+        double p90 = percentile(samples, iterations, 0.90) / 1e3;
+        double p99 = percentile(samples, iterations, 0.99) / 1e3;
+        double max = samples[iterations - 1] / 1e3;
+
+        fprintf(stderr, "%-16s dpi %3u (expected %3u) %s  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+                xcase->name, dpi, expected, failures ? "FAIL" : "ok  ", p50, p90, p99, max);
+        fputs("{\"name\": ", results);
+        fmt_quote_string(results, xcase->name);
+        fprintf(results, ", \"dpi\": %u, \"expected_dpi\": %u, \"iterations\": %zu, \"failures\": %zu"
+                         ", \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}\n",
+                dpi, expected, iterations, failures, p50, p90, p99, max);
+        all_ok = all_ok && failures == 0;
+    }
+
+    free(samples);
+    xcb_disconnect(conn);
+    stop_xvfb();
+    unlink(config_path);
+    if (results != stdout) fclose(results);
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}